@@ -0,0 +1,291 @@
+
+/*
+ * Benchmarks of the gnuplot_i data paths
+ *
+ * Every benchmark sends its data to a gnuplot session using the "unknown"
+ * terminal, so what is measured is the formatting and the transfer through
+ * the pipe, plus however long gnuplot needs to read the data.
+ *
+ * usage: bench [-n iterations] [-r runs] [-j] [-c baseline.json]
+ *
+ *  -n  iterations per run (default 5)
+ *  -r  number of runs, the median and MAD over runs are reported (default 1)
+ *  -j  print the results as JSON, in the format of the baseline file
+ *  -c  compare against a baseline, exit with 1 on regressions
+ *
+ * A benchmark regresses when its median is above the baseline by more than
+ * the tolerance of the baseline entry and by more than 3 MADs, so that a
+ * noisy machine does not fail the comparison on its own.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gnuplot_i.h"
+
+#define NPOINTS     100000
+#define NLINES      8
+#define MAX_RUNS    64
+
+typedef struct {
+    const char* name;
+    /* runs the benchmark once, returns the number of operations done */
+    uint64_t (*run)(gnuplot_ctrl* h);
+    /* allowed relative slowdown when writing a baseline */
+    double tolerance;
+} bench;
+
+static double x[NPOINTS];
+static double* y[NLINES];
+static const char* titles[NLINES];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t bench_plot_x(gnuplot_ctrl* h)
+{
+    gnuplot_resetplot(h);
+    gnuplot_plot_x(h, y[0], NPOINTS, "x");
+    return NPOINTS;
+}
+
+static uint64_t bench_plot_xy(gnuplot_ctrl* h)
+{
+    gnuplot_resetplot(h);
+    gnuplot_plot_xy(h, x, y[0], NPOINTS, "xy");
+    return NPOINTS;
+}
+
+static uint64_t bench_x_multi_y(gnuplot_ctrl* h)
+{
+    gnuplot_resetplot(h);
+    gnuplot_plot_x_multi_y(h, x, y, NPOINTS / NLINES, NLINES, titles);
+    return NPOINTS;
+}
+
+static uint64_t bench_x_multi_y_block(gnuplot_ctrl* h)
+{
+    gnuplot_resetplot(h);
+    gnuplot_set_datablock(h, 1);
+    gnuplot_plot_x_multi_y(h, x, y, NPOINTS / NLINES, NLINES, titles);
+    gnuplot_set_datablock(h, 0);
+    return NPOINTS;
+}
+
+static uint64_t bench_cmd(gnuplot_ctrl* h)
+{
+    for (int i = 0; i < 1000; i++) {
+        gnuplot_cmd(h, "a = %d", i);
+    }
+    return 1000;
+}
+
+static uint64_t bench_hist(gnuplot_ctrl* h)
+{
+    static gnuplot_hist hist;
+    uint64_t v = 88172645463325252ull;
+
+    (void)h;
+    gnuplot_hist_reset(&hist);
+    for (int i = 0; i < NPOINTS; i++) {
+        v ^= v << 13;
+        v ^= v >> 7;
+        v ^= v << 17;
+        gnuplot_hist_record(&hist, v >> (v & 63));
+    }
+    return NPOINTS + (gnuplot_hist_percentile(&hist, 99.0) & 0);
+}
+
+static const bench benches[] = {
+    { "plot_x", bench_plot_x, 0.25 },
+    { "plot_xy", bench_plot_xy, 0.25 },
+    { "plot_x_multi_y", bench_x_multi_y, 0.25 },
+    { "plot_x_multi_y_block", bench_x_multi_y_block, 0.25 },
+    { "cmd", bench_cmd, 0.50 },
+    { "hist_record", bench_hist, 0.15 },
+};
+
+#define NBENCHES (sizeof(benches) / sizeof(benches[0]))
+
+static int cmp_double(const void* a, const void* b)
+{
+    double da = *(const double*)a;
+    double db = *(const double*)b;
+
+    return (da > db) - (da < db);
+}
+
+static double median(double* v, int n)
+{
+    qsort(v, n, sizeof(double), cmp_double);
+    return (n % 2) ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2.0;
+}
+
+/* median absolute deviation */
+static double mad(const double* v, int n, double med)
+{
+    double d[MAX_RUNS];
+
+    for (int i = 0; i < n; i++) {
+        d[i] = fabs(v[i] - med);
+    }
+    return median(d, n);
+}
+
+/*
+ * Looks up a benchmark in a baseline file. The file is only the JSON
+ * written by -j, so a flat scan for the keys is enough.
+ */
+static int baseline_find(const char* json, const char* name, double* ns, double* tol)
+{
+    char key[128];
+
+    snprintf(key, sizeof(key), "\"name\": \"%s\"", name);
+    const char* p = strstr(json, key);
+    if (p == NULL)
+        return -1;
+    const char* end = strchr(p, '}');
+    const char* q = strstr(p, "\"ns_per_op\":");
+    const char* r = strstr(p, "\"tolerance\":");
+    if (end == NULL || q == NULL || r == NULL || q > end || r > end)
+        return -1;
+    *ns = strtod(q + strlen("\"ns_per_op\":"), NULL);
+    *tol = strtod(r + strlen("\"tolerance\":"), NULL);
+    return 0;
+}
+
+static char* read_file(const char* path)
+{
+    FILE* f = fopen(path, "rb");
+    if (f == NULL)
+        return NULL;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* buf = (char*)malloc(len + 1);
+    buf[fread(buf, 1, len, f)] = '\0';
+    fclose(f);
+    return buf;
+}
+
+int main(int argc, char* argv[])
+{
+    gnuplot_ctrl* h;
+    int iters = 5;
+    int runs = 1;
+    int json = 0;
+    const char* compare = NULL;
+    char* baseline = NULL;
+    int regressions = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:r:jc:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iters = atoi(optarg);
+            break;
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'j':
+            json = 1;
+            break;
+        case 'c':
+            compare = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [-r runs] [-j] [-c baseline.json]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (iters < 1)
+        iters = 1;
+    if (runs < 1 || runs > MAX_RUNS)
+        runs = (runs < 1) ? 1 : MAX_RUNS;
+    if (compare != NULL) {
+        baseline = read_file(compare);
+        if (baseline == NULL) {
+            fprintf(stderr, "cannot read baseline %s\n", compare);
+            return 2;
+        }
+    }
+
+    for (int i = 0; i < NLINES; i++) {
+        y[i] = (double*)malloc(sizeof(double) * NPOINTS);
+        titles[i] = "y";
+    }
+    for (int i = 0; i < NPOINTS; i++) {
+        x[i] = (double)i / 100.0;
+        for (int j = 0; j < NLINES; j++) {
+            y[j][i] = sin(x[i] * (j + 1));
+        }
+    }
+
+    h = gnuplot_init();
+    if (h == NULL)
+        return 1;
+    gnuplot_cmd(h, "set terminal unknown");
+    gnuplot_setstyle(h, "lines");
+
+    if (json)
+        printf("{\n  \"benchmarks\": [\n");
+    else
+        printf("%-20s %14s %14s %14s\n", "benchmark", "ns/op", "mad", "baseline");
+    for (uint32_t b = 0; b < NBENCHES; b++) {
+        double samples[MAX_RUNS];
+
+        // warm up once, gnuplot and the caches
+        benches[b].run(h);
+
+        for (int r = 0; r < runs; r++) {
+            uint64_t ops = 0;
+            uint64_t t = now_ns();
+            for (int i = 0; i < iters; i++) {
+                ops += benches[b].run(h);
+            }
+            t = now_ns() - t;
+            samples[r] = (double)t / (double)ops;
+        }
+        double med = median(samples, runs);
+        double dev = mad(samples, runs, med);
+
+        double base_ns = 0.0;
+        double tol = benches[b].tolerance;
+        int found = baseline != NULL
+            && baseline_find(baseline, benches[b].name, &base_ns, &tol) == 0;
+        int slow = found && med > base_ns * (1.0 + tol) && med - base_ns > 3.0 * dev;
+        regressions += slow;
+
+        if (json) {
+            printf("    { \"name\": \"%s\", \"ns_per_op\": %.2f, \"mad\": %.2f, \"tolerance\": %.2f }%s\n",
+                benches[b].name, med, dev, tol, (b + 1 < NBENCHES) ? "," : "");
+        } else if (found) {
+            printf("%-20s %14.2f %14.2f %14.2f %+7.1f%%%s\n", benches[b].name, med, dev,
+                base_ns, (med / base_ns - 1.0) * 100.0, slow ? "  REGRESSION" : "");
+        } else {
+            printf("%-20s %14.2f %14.2f %14s\n", benches[b].name, med, dev, "-");
+        }
+    }
+    if (json)
+        printf("  ]\n}\n");
+
+    gnuplot_close(h);
+    for (int i = 0; i < NLINES; i++) {
+        free(y[i]);
+    }
+    free(baseline);
+    if (regressions > 0) {
+        fprintf(stderr, "%d benchmark(s) slower than the baseline\n", regressions);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,202 @@
+
+/*
+ * Mixed workload through a gnuplot_loop
+ *
+ * One interactive handle redraws a small plot at a fixed rate while batch
+ * handles keep pushing large plots, the way a dashboard and exports share a
+ * process. For each way of scheduling the writes, reports the latency of the
+ * interactive redraws (from the redraw being due until gnuplot has all its
+ * bytes) and the throughput of the batch handles.
+ *
+ * usage: loop [-s seconds] [-b batch handles] [-p period ms]
+ *
+ *  blocking    no loop, every write blocks until its pipe takes it
+ *  fair        one loop, every handle in the batch class
+ *  priority    one loop, the redrawn handle in the interactive class
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gnuplot_i.h"
+
+#define MAX_BATCH       16
+#define MAX_REDRAWS     100000
+#define SMALL_POINTS    500
+#define LARGE_POINTS    10000
+// batch handles keep at least this much queued
+#define BATCH_BACKLOG   (1 << 20)
+
+enum { BLOCKING, FAIR, PRIORITY };
+
+static const char* modes[] = { "blocking", "fair", "priority" };
+
+static double small[SMALL_POINTS];
+static double large[LARGE_POINTS];
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static int cmp_u64(const void* a, const void* b)
+{
+    uint64_t ua = *(const uint64_t*)a;
+    uint64_t ub = *(const uint64_t*)b;
+
+    return (ua > ub) - (ua < ub);
+}
+
+static gnuplot_ctrl* open_handle(void)
+{
+    gnuplot_ctrl* h = gnuplot_init();
+
+    if (h != NULL) {
+        gnuplot_cmd(h, "set terminal unknown");
+        gnuplot_setstyle(h, "lines");
+    }
+    return h;
+}
+
+static int run(int mode, int seconds, int nbatch, int period_ms)
+{
+    static uint64_t latency[MAX_REDRAWS];
+    gnuplot_ctrl* ui = open_handle();
+    gnuplot_ctrl* batch[MAX_BATCH];
+    gnuplot_loop* loop = NULL;
+    uint64_t bytes[MAX_BATCH];
+    uint32_t nredraws = 0;
+
+    if (ui == NULL)
+        return -1;
+    for (int i = 0; i < nbatch; i++) {
+        batch[i] = open_handle();
+        if (batch[i] == NULL)
+            return -1;
+        bytes[i] = gnuplot_get_stats(batch[i])->bytes;
+    }
+    if (mode != BLOCKING) {
+        loop = gnuplot_loop_init(0);
+        gnuplot_loop_add(loop, ui, mode == PRIORITY ? GNUPLOT_PRIO_INTERACTIVE : GNUPLOT_PRIO_BATCH);
+        for (int i = 0; i < nbatch; i++) {
+            gnuplot_loop_add(loop, batch[i], GNUPLOT_PRIO_BATCH);
+        }
+    }
+
+    uint64_t start = now_ns();
+    uint64_t end = start + (uint64_t)seconds * 1000000000;
+    uint64_t due = start;
+    uint64_t pending = 0;
+    int next = 0;
+    for (uint64_t t = start; t < end && nredraws < MAX_REDRAWS; t = now_ns()) {
+        if (pending == 0 && t >= due) {
+            gnuplot_resetplot(ui);
+            gnuplot_plot_x(ui, small, SMALL_POINTS, "ui");
+            pending = due;
+            due += (uint64_t)period_ms * 1000000;
+        }
+
+        if (mode == BLOCKING) {
+            // the redraw was written by the call itself
+            if (pending != 0) {
+                latency[nredraws++] = now_ns() - pending;
+                pending = 0;
+            }
+            gnuplot_resetplot(batch[next]);
+            gnuplot_plot_x(batch[next], large, LARGE_POINTS, "batch");
+            next = (next + 1) % nbatch;
+            continue;
+        }
+
+        // a turn between every batch plot, as an event loop would do
+        for (int i = 0; i < nbatch; i++) {
+            gnuplot_loop_run(loop, 0);
+            if (pending != 0 && gnuplot_loop_pending(ui) == 0) {
+                latency[nredraws++] = now_ns() - pending;
+                pending = 0;
+            }
+            if (gnuplot_loop_pending(batch[i]) < BATCH_BACKLOG) {
+                gnuplot_resetplot(batch[i]);
+                gnuplot_plot_x(batch[i], large, LARGE_POINTS, "batch");
+            }
+        }
+        gnuplot_loop_run(loop, 1);
+        if (pending != 0 && gnuplot_loop_pending(ui) == 0) {
+            latency[nredraws++] = now_ns() - pending;
+            pending = 0;
+        }
+    }
+    double elapsed = (now_ns() - start) / 1e9;
+
+    uint64_t total = 0;
+    for (int i = 0; i < nbatch; i++) {
+        total += gnuplot_get_stats(batch[i])->bytes - bytes[i];
+    }
+    qsort(latency, nredraws, sizeof(uint64_t), cmp_u64);
+    printf("%-10s %8u %10.2f %10.2f %10.2f %12.1f\n", modes[mode], nredraws,
+        nredraws ? latency[nredraws / 2] / 1e6 : 0.0,
+        nredraws ? latency[nredraws * 99 / 100] / 1e6 : 0.0,
+        nredraws ? latency[nredraws - 1] / 1e6 : 0.0,
+        total / elapsed / 1e6);
+
+    gnuplot_loop_close(loop);
+    gnuplot_close(ui);
+    for (int i = 0; i < nbatch; i++) {
+        gnuplot_close(batch[i]);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    int seconds = 3;
+    int nbatch = 3;
+    int period_ms = 20;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:b:p:")) != -1) {
+        switch (opt) {
+        case 's':
+            seconds = atoi(optarg);
+            break;
+        case 'b':
+            nbatch = atoi(optarg);
+            break;
+        case 'p':
+            period_ms = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s seconds] [-b batch handles] [-p period ms]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (nbatch < 1 || nbatch > MAX_BATCH)
+        nbatch = (nbatch < 1) ? 1 : MAX_BATCH;
+    if (seconds < 1)
+        seconds = 1;
+    if (period_ms < 1)
+        period_ms = 1;
+
+    for (int i = 0; i < SMALL_POINTS; i++) {
+        small[i] = sin(i / 10.0);
+    }
+    for (int i = 0; i < LARGE_POINTS; i++) {
+        large[i] = sin(i / 100.0);
+    }
+
+    printf("%-10s %8s %10s %10s %10s %12s\n", "mode", "redraws", "p50 ms", "p99 ms", "max ms", "batch MB/s");
+    for (int mode = BLOCKING; mode <= PRIORITY; mode++) {
+        if (run(mode, seconds, nbatch, period_ms) != 0) {
+            fprintf(stderr, "%s: cannot start gnuplot\n", modes[mode]);
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,240 @@
+
+/*
+ * Cold-start latency of a gnuplot session
+ *
+ * Measures, for each way of getting a session, the time from nothing to
+ * the first rendered frame, split in three phases:
+ *
+ *  spawn    getting a handle (popen, gnuplot_init, pool, gnuplotd)
+ *  write    sending the first plot command and flushing it
+ *  render   until gnuplot acknowledges it has rendered the frame
+ *
+ * usage: startup [-r runs] [-t terminal]
+ *
+ * The frame is rendered with the given terminal (default "dumb") to
+ * /dev/null, so that no window is opened. The pool variant takes a session
+ * warmed up beforehand; the gnuplotd variant only runs if GNUPLOTD_SOCKET
+ * points to a running daemon.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "gnuplot_i.h"
+
+#define MAX_RUNS    64
+#define NPHASES     3
+
+static const char* terminal = "dumb";
+static const char* daemon_path;
+static gnuplot_pool* pool;
+
+typedef struct {
+    const char* name;
+    /* fills the duration of each phase in ns, returns 0 on success */
+    int (*run)(uint64_t* phases);
+} variant;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * popen, as gnuplot_init() used to do. The answer pipe is handed to gnuplot
+ * through the shell as fd 3, like the library does.
+ */
+static int run_popen(uint64_t* phases)
+{
+    int ack[2];
+    char cmd[64];
+    char buf[64];
+
+    if (pipe(ack) != 0)
+        return -1;
+    fcntl(ack[0], F_SETFD, FD_CLOEXEC);
+    snprintf(cmd, sizeof(cmd), "exec gnuplot 3>&%d", ack[1]);
+
+    uint64_t t = now_ns();
+    FILE* f = popen(cmd, "w");
+    close(ack[1]);
+    if (f == NULL) {
+        close(ack[0]);
+        return -1;
+    }
+    phases[0] = now_ns() - t;
+
+    t = now_ns();
+    fprintf(f, "set terminal %s\nset output \"/dev/null\"\nplot sin(x)\n", terminal);
+    fflush(f);
+    phases[1] = now_ns() - t;
+
+    t = now_ns();
+    fprintf(f, "set print \"/dev/fd/3\"\nprint \"ready\"\nset print\n");
+    fflush(f);
+    struct pollfd pfd = { ack[0], POLLIN, 0 };
+    int ok = poll(&pfd, 1, 10000) == 1 && read(ack[0], buf, sizeof(buf)) > 0;
+    phases[2] = now_ns() - t;
+
+    pclose(f);
+    close(ack[0]);
+    return ok ? 0 : -1;
+}
+
+static int run_handle(gnuplot_ctrl* h, uint64_t* phases)
+{
+    uint64_t t = now_ns();
+    gnuplot_cmd(h, "set terminal %s", terminal);
+    gnuplot_cmd(h, "set output \"/dev/null\"");
+    gnuplot_plot_equation(h, "sin(x)", "sine");
+    phases[1] = now_ns() - t;
+
+    t = now_ns();
+    int ret = gnuplot_sync(h, 10000);
+    phases[2] = now_ns() - t;
+
+    return ret;
+}
+
+/* posix_spawn, what gnuplot_init() does */
+static int run_spawn(uint64_t* phases)
+{
+    uint64_t t = now_ns();
+    gnuplot_ctrl* h = gnuplot_init();
+    if (h == NULL)
+        return -1;
+    phases[0] = now_ns() - t;
+
+    int ret = run_handle(h, phases);
+    gnuplot_close(h);
+    return ret;
+}
+
+/* warm session from a pool, started well before it is needed */
+static int run_pool(uint64_t* phases)
+{
+    if (pool == NULL) {
+        pool = gnuplot_pool_init(1);
+        if (pool == NULL)
+            return -1;
+        gnuplot_ctrl* h = gnuplot_pool_acquire(pool);
+        gnuplot_sync(h, 10000);
+        gnuplot_pool_release(pool, h);
+    }
+
+    uint64_t t = now_ns();
+    gnuplot_ctrl* h = gnuplot_pool_acquire(pool);
+    if (h == NULL)
+        return -1;
+    phases[0] = now_ns() - t;
+
+    int ret = run_handle(h, phases);
+    gnuplot_pool_release(pool, h);
+    return ret;
+}
+
+/* session served by gnuplotd */
+static int run_daemon(uint64_t* phases)
+{
+    uint64_t t = now_ns();
+    gnuplot_ctrl* h = gnuplot_connect(daemon_path);
+    if (h == NULL)
+        return -1;
+    phases[0] = now_ns() - t;
+
+    int ret = run_handle(h, phases);
+    gnuplot_close(h);
+    return ret;
+}
+
+static const variant variants[] = {
+    { "popen", run_popen },
+    { "posix_spawn", run_spawn },
+    { "pool", run_pool },
+    { "gnuplotd", run_daemon },
+};
+
+#define NVARIANTS (sizeof(variants) / sizeof(variants[0]))
+
+static int cmp_u64(const void* a, const void* b)
+{
+    uint64_t ua = *(const uint64_t*)a;
+    uint64_t ub = *(const uint64_t*)b;
+
+    return (ua > ub) - (ua < ub);
+}
+
+static double median_ms(uint64_t* v, int n)
+{
+    qsort(v, n, sizeof(uint64_t), cmp_u64);
+    return ((n % 2) ? (double)v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2.0) / 1e6;
+}
+
+int main(int argc, char* argv[])
+{
+    int runs = 9;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:t:")) != -1) {
+        switch (opt) {
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 't':
+            terminal = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r runs] [-t terminal]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (runs < 1 || runs > MAX_RUNS)
+        runs = (runs < 1) ? 1 : MAX_RUNS;
+
+    // only the gnuplotd variant goes through the daemon
+    daemon_path = getenv("GNUPLOTD_SOCKET");
+    if (daemon_path != NULL) {
+        daemon_path = strdup(daemon_path);
+        unsetenv("GNUPLOTD_SOCKET");
+    }
+
+    printf("%-16s %10s %10s %10s %10s\n", "variant", "spawn ms", "write ms", "render ms", "total ms");
+    for (uint32_t v = 0; v < NVARIANTS; v++) {
+        uint64_t phases[NPHASES][MAX_RUNS];
+        uint64_t total[MAX_RUNS];
+
+        if (variants[v].run == run_daemon && daemon_path == NULL)
+            continue;
+
+        for (int r = 0; r < runs; r++) {
+            uint64_t p[NPHASES] = { 0, 0, 0 };
+            if (variants[v].run(p) != 0) {
+                fprintf(stderr, "%s: no answer from gnuplot\n", variants[v].name);
+                return 1;
+            }
+            total[r] = 0;
+            for (int i = 0; i < NPHASES; i++) {
+                phases[i][r] = p[i];
+                total[r] += p[i];
+            }
+        }
+
+        printf("%-16s", variants[v].name);
+        for (int i = 0; i < NPHASES; i++) {
+            printf(" %10.3f", median_ms(phases[i], runs));
+        }
+        printf(" %10.3f\n", median_ms(total, runs));
+    }
+
+    if (pool != NULL)
+        gnuplot_pool_close(pool);
+    return 0;
+}
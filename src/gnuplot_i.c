@@ -25,17 +25,45 @@
                                 Includes
  ---------------------------------------------------------------------------*/
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif // #ifndef _GNU_SOURCE
+
 #include "gnuplot_i.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <math.h>
+#include <time.h>
 
 #ifdef _WIN32
 #include <io.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <spawn.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #endif // #ifdef _WIN32
 
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif // #ifdef __linux__
+
 /*---------------------------------------------------------------------------
                                 Defines
  ---------------------------------------------------------------------------*/
@@ -43,61 +71,589 @@
 // set the buffer size (64K)
 #define BUF_SIZE 1 << 16
 
+// file descriptor of gnuplot on which gnuplot_sync() answers are printed
+#define GNUPLOT_ACK_FD 3
+
+// messages between gnuplotd and its clients
+#define GNUPLOTD_ACQUIRE 1 // client wants a worker
+#define GNUPLOTD_RELEASE 2 // client is done with its worker
+#define GNUPLOTD_DISCARD 3 // client is done, the worker must be killed
+#define GNUPLOTD_WORKER 4 // answer to ACQUIRE, with the worker pipes
+#define GNUPLOTD_ERROR 5 // answer to ACQUIRE, no worker available
+
+// "GPiR", first word of a shared ring
+#define GNUPLOT_RING_MAGIC 0x52695047u
+
+// bytes written to a batch handle per turn of a gnuplot_loop
+#define GNUPLOT_LOOP_QUANTUM (1 << 16)
+
+// most threads used by a single call
+#define GNUPLOT_MAX_THREADS 64
+// most memory of per-thread scratch buffers in a single call (256M)
+#define GNUPLOT_MAX_SCRATCH ((size_t)1 << 28)
+
+// longest gnuplot may take to render an exported frame
+#define GNUPLOT_FRAME_TIMEOUT_MS 60000
+
+// plot width in pixels used until gnuplot knows it
+#define GNUPLOT_SAMPLES_WIDTH 640
+// most samples set by gnuplot_set_samples_auto()
+#define GNUPLOT_SAMPLES_MAX 100000
+// longest gnuplot may take to tell the plot width
+#define GNUPLOT_SAMPLES_TIMEOUT_MS 1000
+// characters of a command looked at for changes of the plot width
+#define GNUPLOT_SAMPLES_CHECK 256
+
+// longest gnuplot may take to save a session
+#define GNUPLOT_SNAPSHOT_TIMEOUT_MS 10000
+
+// bytes of a point sent as "x y" with %18e
+#define GNUPLOT_BUDGET_POINT_BYTES 38
+// fewest points per series of a frame cut to the byte budget
+#define GNUPLOT_BUDGET_MIN_POINTS 64
+
+/*---------------------------------------------------------------------------
+                                New Types
+ ---------------------------------------------------------------------------*/
+
+/*
+ * A message on the gnuplotd socket. The GNUPLOTD_WORKER answer carries the
+ * command pipe and the answer pipe of the worker as SCM_RIGHTS.
+ */
+typedef struct {
+    uint32_t op;
+    int32_t pid;
+} gnuplot_msg;
+
+/*
+ * Layout of a ring in shared memory. Producer and consumer fields are on
+ * separate cache lines, the samples follow as (x, y) pairs.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t capacity;
+    char pad0[56];
+
+    /** Written by the producer: number of samples ever appended */
+    uint64_t head;
+    /** Samples dropped because the ring was full */
+    uint64_t dropped;
+    /** Futex word, bumped on every append */
+    uint32_t seq;
+    /** Set by a consumer about to sleep on seq */
+    uint32_t waiting;
+    char pad1[40];
+
+    /** Written by the consumer: first sample still in use */
+    uint64_t tail;
+    char pad2[56];
+} gnuplot_ring_shm;
+
+struct _GNUPLOT_RING_ {
+    /** Shared header, followed by the samples */
+    gnuplot_ring_shm* shm;
+    /** Samples */
+    double* data;
+    /** Size of the mapping */
+    size_t size;
+    /** memfd of the ring */
+    int fd;
+    /** capacity - 1 */
+    uint32_t mask;
+    /** head when the consumer last looked at the ring */
+    uint64_t seen;
+};
+
+/*
+ * Precomputed twiddle factors and bit reversal of an FFT size.
+ */
+typedef struct {
+    uint32_t n;
+    double* twiddle;
+    uint32_t* rev;
+} gnuplot_fft_plan;
+
+/*
+ * FFT plan, window and buffers of gnuplot_plot_spectrum(), kept in the
+ * handle between calls.
+ */
+typedef struct _GNUPLOT_SPECTRUM_ {
+    /** Number of samples and window the state was made for */
+    uint32_t n;
+    uint32_t type;
+    /** Size of the real transform, n rounded up to a power of two */
+    uint32_t size;
+    /** Complex transform of size / 2 */
+    gnuplot_fft_plan* plan;
+    /** Window coefficients of the n samples */
+    double* window;
+    /** Twiddles splitting the complex transform into the real one */
+    double* split;
+    /** Windowed samples then transform, size doubles */
+    double* data;
+    /** Plotted points, frequency and dB */
+    double* out;
+    /** Scale of magnitudes, so that a full scale sine is 0 dB */
+    double scale;
+} gnuplot_spectrum;
+
+struct _GNUPLOT_WATERFALL_ {
+    /** Transform of each block */
+    gnuplot_spectrum* spectrum;
+    /** Samples between blocks, rows of the image, frequency bins of a row */
+    uint32_t hop;
+    uint32_t rows;
+    uint32_t bins;
+    double fs;
+    /** Block being filled, fill samples so far */
+    double* pending;
+    uint32_t fill;
+    /** Samples to skip before the next block, when hop > block size */
+    uint32_t skip;
+    /** Rows of dB magnitudes, head is the next row written */
+    float* image;
+    uint32_t head;
+    /** Rows computed so far, rows in the last frame */
+    uint64_t total;
+    uint64_t drawn;
+    /** Least time between frames and time of the last one, in ns */
+    uint64_t interval;
+    uint64_t last;
+};
+
+/*
+ * One piece of a parallel loop, see gnuplot_parallel().
+ */
+typedef struct {
+    void (*fn)(void* arg, uint32_t index);
+    void* arg;
+    uint32_t index;
+} gnuplot_task;
+
+#ifndef _WIN32
+struct _GNUPLOT_LOOP_ {
+    /** Handles in the loop */
+    gnuplot_ctrl** handles;
+    uint32_t n;
+    uint32_t size;
+    /** Batch handle served first in the next turn */
+    uint32_t next;
+    /** Most bytes written to a batch handle in a turn */
+    size_t quantum;
+    /** Poll set, one entry per handle with bytes queued */
+    struct pollfd* pfds;
+};
+#endif // #ifndef _WIN32
+
+struct _GNUPLOT_POOL_ {
+    /** Idle gnuplot sessions, ready to be handed out */
+    gnuplot_ctrl** idle;
+    /** Number of idle sessions */
+    uint32_t nidle;
+    /** Number of sessions to keep warm */
+    uint32_t size;
+    /** Template applied to every session, NULL if none */
+    gnuplot_template* tmpl;
+};
+
+struct _GNUPLOT_SESSION_ {
+    /** Datablocks then settings, as one file to load */
+    gnuplot_template* tpl;
+    /** State of the handle the snapshot was taken from */
+    char pstyle[128];
+    uint32_t nplots;
+    uint32_t nblocks;
+    uint32_t datablock;
+};
+
+struct _GNUPLOT_TEMPLATE_ {
+    /** Commands, one per line */
+    char* text;
+    size_t len;
+    size_t size;
+    /** File the commands are loaded from, empty until first applied */
+    char path[64];
+};
+
+// scheduling of new handles and of the threads the library starts
+static gnuplot_sched gnuplot_default_sched;
+
 /*---------------------------------------------------------------------------
                           Prototype Functions
  ---------------------------------------------------------------------------*/
 
+static uint64_t gnuplot_now(void);
+static int gnuplot_spawn(gnuplot_ctrl* handle);
+static int gnuplot_sched_apply(const gnuplot_sched* sched, int32_t id, int process);
+static void gnuplot_sched_thread(void);
+static FILE* gnuplot_open_pipe(gnuplot_ctrl* handle, int fd);
+static void gnuplot_samples_check(gnuplot_ctrl* handle, const char* cmd, va_list ap);
+static int gnuplot_roundtrip(gnuplot_ctrl* handle, const char* expr, char* out, size_t len, int timeout_ms);
+static int gnuplot_reap(gnuplot_ctrl* handle, int force);
+static gnuplot_ctrl* gnuplot_alloc(void);
+static void gnuplot_free(gnuplot_ctrl* handle);
+static void gnuplot_datablock(gnuplot_ctrl* handle, char* name, size_t len);
+static uint64_t gnuplot_send_series(gnuplot_ctrl* handle, const double* x, const double* y, uint32_t n, uint32_t target);
+static uint32_t gnuplot_lod_target(gnuplot_ctrl* handle, uint32_t l, uint32_t n);
+static double gnuplot_budget_refill(gnuplot_ctrl* handle);
+static int gnuplot_budget_frame(gnuplot_ctrl* handle);
+static void gnuplot_lod_update(gnuplot_ctrl* handle, uint64_t t, uint64_t sent);
+static void gnuplot_plot_block(gnuplot_ctrl* handle, const char* cmd, const char* name, uint32_t l, const char** title);
+static uint32_t gnuplot_nthreads(uint64_t work, size_t scratch);
+static void gnuplot_parallel(uint32_t nthreads, void (*fn)(void* arg, uint32_t index), void* arg);
+static gnuplot_fft_plan* gnuplot_fft_plan_init(uint32_t n);
+static void gnuplot_fft_plan_free(gnuplot_fft_plan* plan);
+static void gnuplot_fft(const gnuplot_fft_plan* plan, double* data, int inverse);
+static void gnuplot_spectrum_free(gnuplot_spectrum* spectrum);
+static void gnuplot_pool_discard(gnuplot_pool* pool, gnuplot_ctrl* handle);
+#ifndef _WIN32
+static void gnuplot_budget_wait(gnuplot_ctrl* handle, size_t size);
+static ssize_t gnuplot_queue_push(gnuplot_ctrl* handle, const char* buf, size_t size);
+static ssize_t gnuplot_queue_write(gnuplot_ctrl* handle, size_t max);
+static int gnuplot_queue_flush(gnuplot_ctrl* handle);
+static int gnuplot_msg_send(int sock, uint32_t op, int32_t pid, const int* fds, int nfds);
+static int gnuplot_msg_recv(int sock, gnuplot_msg* msg, int* fds, int nfds);
+static int gnuplot_daemon_connect(const char* path);
+static int gnuplot_daemon_acquire(gnuplot_ctrl* handle);
+static int gnuplot_daemon_release(gnuplot_ctrl* handle, int force);
+#endif // #ifndef _WIN32
+
 /*---------------------------------------------------------------------------
                             Function codes
  ---------------------------------------------------------------------------*/
 
-gnuplot_ctrl* gnuplot_init(void)
+static uint64_t gnuplot_now(void)
 {
-    gnuplot_ctrl* handle;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
 
 #ifndef _WIN32
-    if (getenv("DISPLAY") == NULL) {
-        fprintf(stderr, "cannot find DISPLAY variable: is it set?\n");
+extern char** environ;
+#endif // #ifndef _WIN32
+
+/*
+ * Start gnuplot with a pipe on its stdin. posix_spawn is used instead of
+ * popen so that we know the pid of gnuplot itself, not the one of a shell.
+ */
+static int gnuplot_spawn(gnuplot_ctrl* handle)
+{
+#ifdef _WIN32
+    handle->gnucmd = popen("gnuplot", "w");
+    if (handle->gnucmd == NULL)
+        return -1;
+    handle->pid = 0;
+#else
+    if (handle->daemon >= 0) {
+        if (gnuplot_daemon_acquire(handle) != 0)
+            return -1;
+        // the worker is spawned by the daemon, the settings go to the pid it reports
+        if (handle->sched.flags != 0 && handle->pid > 0) {
+            handle->resched = 1;
+            if (gnuplot_sched_apply(&handle->sched, handle->pid, 1) != 0)
+                fprintf(stderr, "cannot apply the scheduling settings to gnuplot\n");
+        }
+        return 0;
+    }
+
+    int fds[2];
+    int ack[2];
+    pid_t pid;
+    char* argv[] = { "gnuplot", NULL };
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+
+    if (pipe(fds) != 0)
+        return -1;
+    if (pipe(ack) != 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    fcntl(ack[0], F_SETFD, FD_CLOEXEC);
+    fcntl(ack[1], F_SETFD, FD_CLOEXEC);
+
+    // commands on stdin, answers to gnuplot_sync() on fd 3
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, ack[1], GNUPLOT_ACK_FD);
+    posix_spawnattr_init(&attr);
+#ifdef __linux__
+    // SCHED_IDLE from the first instruction, the other settings follow the spawn
+    if (handle->sched.flags & GNUPLOT_SCHED_IDLE) {
+        struct sched_param param = { 0 };
+        posix_spawnattr_setschedpolicy(&attr, SCHED_IDLE);
+        posix_spawnattr_setschedparam(&attr, &param);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSCHEDULER);
+    }
+#endif // #ifdef __linux__
+    int err = posix_spawnp(&pid, "gnuplot", &actions, &attr, argv, environ);
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[0]);
+    close(ack[1]);
+    if (err != 0) {
+        close(fds[1]);
+        close(ack[0]);
+        return -1;
+    }
+
+    handle->gnucmd = gnuplot_open_pipe(handle, fds[1]);
+    if (handle->gnucmd == NULL) {
+        close(fds[1]);
+        close(ack[0]);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        return -1;
+    }
+    handle->ack = ack[0];
+    handle->pid = (int32_t)pid;
+#endif // #ifdef _WIN32
+
+    if (handle->sched.flags != 0 && handle->pid > 0
+        && gnuplot_sched_apply(&handle->sched, handle->pid, 1) != 0)
+        fprintf(stderr, "cannot apply the scheduling settings to gnuplot\n");
+
+    // set the buffer, in an easy way
+    setvbuf(handle->gnucmd, handle->BUF, _IOFBF, BUF_SIZE);
+
+    return 0;
+}
+
+#ifndef _WIN32
+/*
+ * All data sent to gnuplot goes through this function, so that every
+ * write() on the pipe can be timed.
+ */
+static ssize_t gnuplot_pipe_write(void* cookie, const char* buf, size_t size)
+{
+    gnuplot_ctrl* handle = (gnuplot_ctrl*)cookie;
+    size_t done = 0;
+    int queued;
+
+    // in a loop, the loop writes when the pipe can take it
+    if (handle->loop != NULL)
+        return gnuplot_queue_push(handle, buf, size);
+
+    if (ioctl(handle->fd, FIONREAD, &queued) == 0)
+        gnuplot_hist_record(&handle->queue_hist, (uint64_t)queued);
+
+    while (done < size) {
+        size_t chunk = size - done;
+        if (handle->budget_rate > 0 && handle->budget_policy == GNUPLOT_BUDGET_BLOCK) {
+            chunk = (chunk < handle->budget_burst) ? chunk : (size_t)handle->budget_burst;
+            gnuplot_budget_wait(handle, chunk);
+        }
+
+        uint64_t t = gnuplot_now();
+        ssize_t w = write(handle->fd, buf + done, chunk);
+        t = gnuplot_now() - t;
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            return done > 0 ? (ssize_t)done : -1;
+        }
+
+        gnuplot_hist_record(&handle->write_hist, t);
+        handle->stats.writes++;
+        handle->stats.bytes += (uint64_t)w;
+        handle->stats.write_ns += t;
+        handle->budget_tokens -= (double)w;
+        done += (size_t)w;
     }
+
+    return (ssize_t)done;
+}
+
+static int gnuplot_pipe_close(void* cookie)
+{
+    gnuplot_ctrl* handle = (gnuplot_ctrl*)cookie;
+
+    int ret = close(handle->fd);
+    handle->fd = -1;
+    return ret;
+}
 #endif // #ifndef _WIN32
 
+static FILE* gnuplot_open_pipe(gnuplot_ctrl* handle, int fd)
+{
+    handle->fd = fd;
+#ifdef __GLIBC__
+    cookie_io_functions_t io = { NULL, gnuplot_pipe_write, NULL, gnuplot_pipe_close };
+    return fopencookie(handle, "w", io);
+#else
+    return fdopen(fd, "w");
+#endif // #ifdef __GLIBC__
+}
+
+/*
+ * Close the pipe and wait for gnuplot to exit. If force is set, gnuplot
+ * is killed first instead of being left to finish its pending commands.
+ */
+static int gnuplot_reap(gnuplot_ctrl* handle, int force)
+{
+#ifdef _WIN32
+    (void)force;
+    return pclose(handle->gnucmd) == -1 ? -1 : 0;
+#else
+    int status;
+
+    if (handle->daemon >= 0)
+        return gnuplot_daemon_release(handle, force);
+
+    if (force) {
+        handle->queue_head = handle->queue_tail = 0;
+        if (handle->pid > 0)
+            kill((pid_t)handle->pid, SIGKILL);
+        // a dead gnuplot cannot take the buffered data anymore, drop it
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, handle->fd);
+            close(null);
+        }
+    }
+    if (handle->gnucmd != NULL)
+        fclose(handle->gnucmd);
+    handle->gnucmd = NULL;
+    if (handle->ack >= 0) {
+        close(handle->ack);
+        handle->ack = -1;
+    }
+    if (handle->pid <= 0)
+        return 0;
+
+    while (waitpid((pid_t)handle->pid, &status, 0) == -1) {
+        if (errno != EINTR)
+            return -1;
+    }
+    handle->pid = 0;
+
+    return 0;
+#endif // #ifdef _WIN32
+}
+
+static gnuplot_ctrl* gnuplot_alloc(void)
+{
+    gnuplot_ctrl* handle;
+
     /*
      * Structure initialization:
      */
-    handle = (gnuplot_ctrl*)malloc(sizeof(gnuplot_ctrl));
+    handle = (gnuplot_ctrl*)calloc(1, sizeof(gnuplot_ctrl));
     handle->nplots = 0;
     handle->multiplot = 0;
     gnuplot_setstyle(handle, "points");
 
-    handle->gnucmd = popen("gnuplot", "w");
-    if (handle->gnucmd == NULL) {
+    handle->BUF = (char*)malloc(BUF_SIZE);
+    handle->daemon = -1;
+    handle->sched = gnuplot_default_sched;
+#ifndef _WIN32
+    // answers of different processes sharing a gnuplot never look alike
+    handle->sync_seq = (uint32_t)getpid() << 16;
+#endif // #ifndef _WIN32
+
+    return handle;
+}
+
+static void gnuplot_free(gnuplot_ctrl* handle)
+{
+    gnuplot_spectrum_free(handle->spectrum);
+    free(handle->queue);
+    free(handle->BUF);
+    free(handle);
+}
+
+gnuplot_ctrl* gnuplot_init(void)
+{
+    gnuplot_ctrl* handle;
+
+#ifndef _WIN32
+    if (getenv("DISPLAY") == NULL) {
+        fprintf(stderr, "cannot find DISPLAY variable: is it set?\n");
+    }
+#endif // #ifndef _WIN32
+
+    handle = gnuplot_alloc();
+
+#ifndef _WIN32
+    const char* path = getenv("GNUPLOTD_SOCKET");
+    if (path != NULL && *path != '\0') {
+        handle->daemon = gnuplot_daemon_connect(path);
+        if (handle->daemon >= 0 && gnuplot_spawn(handle) == 0)
+            return handle;
+
+        // no daemon, or no worker left: start our own gnuplot
+        if (handle->daemon >= 0)
+            close(handle->daemon);
+        handle->daemon = -1;
+    }
+#endif // #ifndef _WIN32
+
+    if (gnuplot_spawn(handle) != 0) {
         fprintf(stderr, "error starting gnuplot, is gnuplot or gnuplot.exe in your path?\n");
-        free(handle);
+        gnuplot_free(handle);
         return NULL;
     }
 
-    // set the buffer, in an easy way
-    handle->BUF = (char*)malloc(BUF_SIZE);
-    setbuf(handle->gnucmd, handle->BUF);
+    return handle;
+}
+
+gnuplot_ctrl* gnuplot_connect(const char* path)
+{
+#ifdef _WIN32
+    (void)path;
+    return NULL;
+#else
+    gnuplot_ctrl* handle;
+
+    handle = gnuplot_alloc();
+    handle->daemon = gnuplot_daemon_connect(path);
+    if (handle->daemon < 0 || gnuplot_spawn(handle) != 0) {
+        fprintf(stderr, "cannot get a gnuplot from the daemon at %s\n", path);
+        if (handle->daemon >= 0)
+            close(handle->daemon);
+        gnuplot_free(handle);
+        return NULL;
+    }
 
     return handle;
+#endif // #ifdef _WIN32
 }
 
 void gnuplot_close(gnuplot_ctrl* handle)
 {
-    if (pclose(handle->gnucmd) == -1) {
+#ifndef _WIN32
+    gnuplot_loop_remove(handle->loop, handle);
+#endif // #ifndef _WIN32
+    if (gnuplot_reap(handle, 0) != 0) {
         fprintf(stderr, "problem closing communication to gnuplot\n");
         return;
     }
+#ifndef _WIN32
+    if (handle->daemon >= 0)
+        close(handle->daemon);
+#endif // #ifndef _WIN32
 
-    free(handle->BUF);
-    free(handle);
+    gnuplot_free(handle);
 }
 
 void gnuplot_cmd(gnuplot_ctrl* handle, const char* cmd, ...)
 {
     va_list ap;
 
+    if (handle->dead) {
+        fprintf(stderr, "gnuplot is not running, command dropped\n");
+        return;
+    }
+    if (handle->samples_oversample > 0.0) {
+        va_start(ap, cmd);
+        gnuplot_samples_check(handle, cmd, ap);
+        va_end(ap);
+    }
     va_start(ap, cmd);
     vfprintf(handle->gnucmd, cmd, ap);
     va_end(ap);
@@ -110,6 +666,8 @@ void gnuplot_printf(gnuplot_ctrl* handle, const char* cmd, ...)
 {
     va_list ap;
 
+    if (handle->dead)
+        return;
     va_start(ap, cmd);
     vfprintf(handle->gnucmd, cmd, ap);
     va_end(ap);
@@ -117,6 +675,93 @@ void gnuplot_printf(gnuplot_ctrl* handle, const char* cmd, ...)
     fputs("\n", handle->gnucmd);
 }
 
+int gnuplot_sync(gnuplot_ctrl* handle, int timeout_ms)
+{
+    return gnuplot_roundtrip(handle, NULL, NULL, 0, timeout_ms);
+}
+
+/*
+ * Have gnuplot print a tagged line on the answer pipe, optionally followed
+ * by the value of expr, and wait for it. Since gnuplot runs its input in
+ * order, the answer also means every previous command has been executed.
+ */
+static int gnuplot_roundtrip(gnuplot_ctrl* handle, const char* expr, char* out, size_t len, int timeout_ms)
+{
+#ifdef _WIN32
+    (void)handle;
+    (void)expr;
+    (void)out;
+    (void)len;
+    (void)timeout_ms;
+    return -1;
+#else
+    char tag[32];
+    char line[1024];
+    size_t used = 0;
+
+    if (handle == NULL || handle->ack < 0)
+        return -1;
+
+    uint32_t seq = ++handle->sync_seq;
+    int taglen = snprintf(tag, sizeof(tag), "gnuplot_i %u", seq);
+    gnuplot_cmd(handle, "set print \"/dev/fd/%d\"", GNUPLOT_ACK_FD);
+    if (expr != NULL)
+        gnuplot_cmd(handle, "print \"%s\", %s", tag, expr);
+    else
+        gnuplot_cmd(handle, "print \"%s\"", tag);
+    gnuplot_cmd(handle, "set print");
+    if (handle->loop != NULL && gnuplot_queue_flush(handle) != 0)
+        return -1;
+
+    uint64_t deadline = gnuplot_now() + (uint64_t)timeout_ms * 1000000;
+    for (;;) {
+        struct pollfd pfd = { handle->ack, POLLIN, 0 };
+        int wait = -1;
+        if (timeout_ms >= 0) {
+            uint64_t t = gnuplot_now();
+            if (t >= deadline)
+                return -1;
+            wait = (int)((deadline - t + 999999) / 1000000);
+        }
+
+        int ret = poll(&pfd, 1, wait);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret <= 0)
+            return -1;
+
+        ssize_t r = read(handle->ack, line + used, sizeof(line) - 1 - used);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return -1;
+        used += (size_t)r;
+        line[used] = '\0';
+
+        // look at every complete line, answers to older requests are skipped
+        char* start = line;
+        char* nl;
+        while ((nl = strchr(start, '\n')) != NULL) {
+            *nl = '\0';
+            if (strncmp(start, tag, taglen) == 0
+                && (start[taglen] == '\0' || start[taglen] == ' ')) {
+                if (out != NULL && len > 0) {
+                    const char* value = start + taglen + (start[taglen] == ' ');
+                    strncpy(out, value, len - 1);
+                    out[len - 1] = '\0';
+                }
+                return 0;
+            }
+            start = nl + 1;
+        }
+        used = strlen(start);
+        memmove(line, start, used);
+        if (used == sizeof(line) - 1)
+            used = 0;
+    }
+#endif // #ifdef _WIN32
+}
+
 void gnuplot_multiplot(gnuplot_ctrl* handle, const char* opt)
 {
     if (handle->multiplot == 0) {
@@ -143,6 +788,11 @@ void gnuplot_setstyle(gnuplot_ctrl* handle, const char* plot_style)
     }
 }
 
+void gnuplot_set_datablock(gnuplot_ctrl* handle, uint32_t enable)
+{
+    handle->datablock = enable;
+}
+
 void gnuplot_set_xlabel(gnuplot_ctrl* handle, const char* label)
 {
     gnuplot_cmd(handle, "set xlabel \"%s\"", label);
@@ -156,6 +806,219 @@ void gnuplot_set_ylabel(gnuplot_ctrl* handle, const char* label)
 void gnuplot_resetplot(gnuplot_ctrl* handle)
 {
     handle->nplots = 0;
+    handle->nblocks = 0;
+
+    if (handle->monitor_ms > 0
+        && gnuplot_now() - handle->monitor_last >= (uint64_t)handle->monitor_ms * 1000000) {
+        gnuplot_monitor(handle);
+    }
+}
+
+void gnuplot_set_limits(
+    gnuplot_ctrl* handle,
+    uint32_t interval_ms,
+    uint64_t rss_limit,
+    uint64_t cpu_limit)
+{
+    handle->monitor_ms = interval_ms;
+    handle->rss_limit = rss_limit;
+    handle->cpu_limit = cpu_limit;
+}
+
+#ifdef __linux__
+/*
+ * Starts gnuplot again in place of a reaped one. If it cannot be started,
+ * the handle writes to /dev/null and drops commands until a later
+ * gnuplot_monitor() manages to.
+ */
+static int gnuplot_respawn(gnuplot_ctrl* handle)
+{
+    if (gnuplot_spawn(handle) != 0) {
+        fprintf(stderr, "error respawning gnuplot\n");
+        handle->gnucmd = fopen("/dev/null", "w");
+        handle->fd = -1;
+        handle->dead = 1;
+        return -1;
+    }
+    handle->dead = 0;
+    if (handle->loop != NULL)
+        fcntl(handle->fd, F_SETFL, fcntl(handle->fd, F_GETFL) | O_NONBLOCK);
+    handle->samples_width = 0;
+    handle->samples = 0;
+    if (handle->tmpl != NULL)
+        gnuplot_template_apply(handle, handle->tmpl);
+    handle->nplots = 0;
+    handle->multiplot = 0;
+    handle->stats.cpu_ns = 0;
+    handle->stats.rss = 0;
+    handle->stats.respawns++;
+    return 0;
+}
+#endif // #ifdef __linux__
+
+int gnuplot_monitor(gnuplot_ctrl* handle)
+{
+#ifdef __linux__
+    char path[64];
+    char buf[1024];
+    unsigned long utime, stime;
+    long rss;
+
+    if (handle == NULL)
+        return -1;
+    if (handle->dead) {
+        handle->monitor_last = gnuplot_now();
+        if (handle->gnucmd != NULL)
+            fclose(handle->gnucmd);
+        handle->gnucmd = NULL;
+        return (gnuplot_respawn(handle) == 0) ? 1 : -1;
+    }
+    if (handle->pid <= 0)
+        return -1;
+    handle->monitor_last = gnuplot_now();
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)handle->pid);
+    FILE* f = fopen(path, "r");
+    if (f == NULL)
+        return -1;
+    size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[len] = '\0';
+
+    // the command name may contain spaces, fields are counted from the last ')'
+    char* p = strrchr(buf, ')');
+    if (p == NULL || sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu "
+                                   "%*d %*d %*d %*d %*d %*d %*u %*u %ld",
+                         &utime, &stime, &rss)
+            != 3)
+        return -1;
+
+    uint64_t tick = (uint64_t)sysconf(_SC_CLK_TCK);
+    handle->stats.cpu_ns = (uint64_t)(utime + stime) * (1000000000 / tick);
+    handle->stats.rss = (uint64_t)rss * (uint64_t)sysconf(_SC_PAGESIZE);
+    if (handle->stats.rss > handle->stats.rss_peak)
+        handle->stats.rss_peak = handle->stats.rss;
+    handle->stats.samples++;
+
+    if ((handle->rss_limit > 0 && handle->stats.rss > handle->rss_limit)
+        || (handle->cpu_limit > 0 && handle->stats.cpu_ns > handle->cpu_limit)) {
+        fprintf(stderr, "gnuplot exceeded its resource limits, respawning\n");
+        gnuplot_reap(handle, 1);
+        return (gnuplot_respawn(handle) == 0) ? 1 : -1;
+    }
+
+    return 0;
+#else
+    (void)handle;
+    return -1;
+#endif // #ifdef __linux__
+}
+
+const gnuplot_stats* gnuplot_get_stats(const gnuplot_ctrl* handle)
+{
+    return &handle->stats;
+}
+
+const gnuplot_hist* gnuplot_get_write_hist(const gnuplot_ctrl* handle)
+{
+    return &handle->write_hist;
+}
+
+const gnuplot_hist* gnuplot_get_queue_hist(const gnuplot_ctrl* handle)
+{
+    return &handle->queue_hist;
+}
+
+void gnuplot_hist_reset(gnuplot_hist* hist)
+{
+    memset(hist, 0, sizeof(gnuplot_hist));
+}
+
+/*
+ * Values below 2^SUB_BITS have their own bucket, above that each power of
+ * two is split into 2^SUB_BITS linear sub-buckets.
+ */
+static uint32_t gnuplot_hist_index(uint64_t value)
+{
+    const uint32_t sub = 1u << GNUPLOT_HIST_SUB_BITS;
+
+    if (value < sub)
+        return (uint32_t)value;
+#ifdef __GNUC__
+    uint32_t e = 63 - (uint32_t)__builtin_clzll(value);
+#else
+    uint32_t e = 0;
+    while ((value >> e) > 1)
+        e++;
+#endif // #ifdef __GNUC__
+    uint32_t shift = e - GNUPLOT_HIST_SUB_BITS;
+    return ((shift + 1) << GNUPLOT_HIST_SUB_BITS) | (uint32_t)((value >> shift) & (sub - 1));
+}
+
+static uint64_t gnuplot_hist_upper(uint32_t index)
+{
+    const uint32_t sub = 1u << GNUPLOT_HIST_SUB_BITS;
+
+    if (index < sub)
+        return index;
+    uint32_t shift = (index >> GNUPLOT_HIST_SUB_BITS) - 1;
+    uint64_t low = (uint64_t)(sub + (index & (sub - 1))) << shift;
+    return low + (((uint64_t)1 << shift) - 1);
+}
+
+void gnuplot_hist_record(gnuplot_hist* hist, uint64_t value)
+{
+    if (hist->count == 0 || value < hist->min)
+        hist->min = value;
+    if (value > hist->max)
+        hist->max = value;
+    hist->count++;
+    hist->sum += value;
+    hist->buckets[gnuplot_hist_index(value)]++;
+}
+
+void gnuplot_hist_merge(gnuplot_hist* dst, const gnuplot_hist* src)
+{
+    if (src->count == 0)
+        return;
+    if (dst->count == 0 || src->min < dst->min)
+        dst->min = src->min;
+    if (src->max > dst->max)
+        dst->max = src->max;
+    dst->count += src->count;
+    dst->sum += src->sum;
+    for (uint32_t i = 0; i < GNUPLOT_HIST_BUCKETS; i++) {
+        dst->buckets[i] += src->buckets[i];
+    }
+}
+
+uint64_t gnuplot_hist_percentile(const gnuplot_hist* hist, double percentile)
+{
+    if (hist->count == 0)
+        return 0;
+    if (percentile < 0.0)
+        percentile = 0.0;
+    if (percentile > 100.0)
+        percentile = 100.0;
+
+    uint64_t rank = (uint64_t)(percentile / 100.0 * (double)hist->count + 0.5);
+    if (rank < 1)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < GNUPLOT_HIST_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank) {
+            uint64_t v = gnuplot_hist_upper(i);
+            if (v > hist->max)
+                v = hist->max;
+            if (v < hist->min)
+                v = hist->min;
+            return v;
+        }
+    }
+
+    return hist->max;
 }
 
 void gnuplot_plot_x(
@@ -169,13 +1032,15 @@ void gnuplot_plot_x(
     const char* cmd = (handle->multiplot == 0 && handle->nplots > 0) ? "replot" : "plot";
     title = (title == NULL) ? "(none)" : title;
 
+    if (!gnuplot_budget_frame(handle))
+        return;
+
+    uint64_t t = gnuplot_now();
     gnuplot_cmd(handle, "%s '-' title \"%s\" with %s",
         cmd, title, handle->pstyle);
 
-    for (uint32_t i = 0; i < n; i++) {
-        gnuplot_printf(handle, "%18e", d[i]);
-    }
-    gnuplot_cmd(handle, "e");
+    uint64_t sent = gnuplot_send_series(handle, NULL, d, n, gnuplot_lod_target(handle, 1, n));
+    gnuplot_lod_update(handle, t, sent);
 
     handle->nplots++;
 }
@@ -205,6 +1070,10 @@ void gnuplot_plot_multi_x(
         }
     }
 
+    if (!gnuplot_budget_frame(handle))
+        return;
+
+    uint64_t t = gnuplot_now();
     gnuplot_printf(handle, "%s '-' title \"%s\" with %s \\",
         cmd, title[0], handle->pstyle);
 
@@ -215,13 +1084,12 @@ void gnuplot_plot_multi_x(
 
     gnuplot_cmd(handle, "");
 
+    uint32_t target = gnuplot_lod_target(handle, l, n);
+    uint64_t sent = 0;
     for (uint32_t i = 0; i < l; i++) {
-        for (uint32_t j = 0; j < n; j++) {
-            gnuplot_printf(handle, "%18e", d[i][j]);
-        }
-
-        gnuplot_cmd(handle, "e");
+        sent += gnuplot_send_series(handle, NULL, d[i], n, target);
     }
+    gnuplot_lod_update(handle, t, sent);
 
     handle->nplots += l;
 }
@@ -238,13 +1106,15 @@ void gnuplot_plot_xy(
     const char* cmd = (handle->multiplot == 0 && handle->nplots > 0) ? "replot" : "plot";
     title = (title == NULL) ? "(none)" : title;
 
+    if (!gnuplot_budget_frame(handle))
+        return;
+
+    uint64_t t = gnuplot_now();
     gnuplot_cmd(handle, "%s '-' title \"%s\" with %s",
         cmd, title, handle->pstyle);
 
-    for (uint32_t i = 0; i < n; i++) {
-        gnuplot_printf(handle, "%18e %18e", x[i], y[i]);
-    }
-    gnuplot_cmd(handle, "e");
+    uint64_t sent = gnuplot_send_series(handle, x, y, n, gnuplot_lod_target(handle, 1, n));
+    gnuplot_lod_update(handle, t, sent);
 
     handle->nplots++;
 }
@@ -275,6 +1145,26 @@ void gnuplot_plot_x_multi_y(
         }
     }
 
+    if (!gnuplot_budget_frame(handle))
+        return;
+
+    if (handle->datablock) {
+        // x once per row, then a column per list
+        char name[32];
+        gnuplot_datablock(handle, name, sizeof(name));
+        for (uint32_t j = 0; j < n; j++) {
+            fprintf(handle->gnucmd, "%18e", x[j]);
+            for (uint32_t i = 0; i < l; i++) {
+                fprintf(handle->gnucmd, " %18e", y[i][j]);
+            }
+            fputs("\n", handle->gnucmd);
+        }
+        gnuplot_cmd(handle, "EOD");
+        gnuplot_plot_block(handle, cmd, name, l, title);
+        return;
+    }
+
+    uint64_t t = gnuplot_now();
     gnuplot_cmd(handle, "%s '-' title \"%s\" with %s \\",
         cmd, title[0], handle->pstyle);
 
@@ -285,13 +1175,12 @@ void gnuplot_plot_x_multi_y(
 
     gnuplot_cmd(handle, "");
 
+    uint32_t target = gnuplot_lod_target(handle, l, n);
+    uint64_t sent = 0;
     for (uint32_t i = 0; i < l; i++) {
-        for (uint32_t j = 0; j < n; j++) {
-            gnuplot_printf(handle, "%18e %18e", x[j], y[i][j]);
-        }
-
-        gnuplot_cmd(handle, "e");
+        sent += gnuplot_send_series(handle, x, y[i], n, target);
     }
+    gnuplot_lod_update(handle, t, sent);
 
     handle->nplots += l;
 }
@@ -322,6 +1211,10 @@ void gnuplot_plot_multi_xy(
         }
     }
 
+    if (!gnuplot_budget_frame(handle))
+        return;
+
+    uint64_t t = gnuplot_now();
     gnuplot_cmd(handle, "%s '-' title \"%s\" with %s \\",
         cmd, title[0], handle->pstyle);
 
@@ -332,13 +1225,16 @@ void gnuplot_plot_multi_xy(
 
     gnuplot_cmd(handle, "");
 
+    uint32_t longest = 0;
     for (uint32_t i = 0; i < l; i++) {
-        for (uint32_t j = 0; j < n[i]; j++) {
-            gnuplot_printf(handle, "%18e %18e", x[i][j], y[i][j]);
-        }
-
-        gnuplot_cmd(handle, "e");
+        longest = (n[i] > longest) ? n[i] : longest;
+    }
+    uint32_t target = gnuplot_lod_target(handle, l, longest);
+    uint64_t sent = 0;
+    for (uint32_t i = 0; i < l; i++) {
+        sent += gnuplot_send_series(handle, x[i], y[i], n[i], target);
     }
+    gnuplot_lod_update(handle, t, sent);
 
     handle->nplots += l;
 }
@@ -358,6 +1254,93 @@ void gnuplot_plot_slope(
     handle->nplots++;
 }
 
+/*
+ * Forgets what is known of the plot width and samples when a command may
+ * change them. The formatted command is checked, each of its statements.
+ */
+static void gnuplot_samples_check(gnuplot_ctrl* handle, const char* cmd, va_list ap)
+{
+    char buf[GNUPLOT_SAMPLES_CHECK];
+    char* text = buf;
+    va_list aq;
+
+    va_copy(aq, ap);
+    int len = vsnprintf(buf, sizeof(buf), cmd, ap);
+    // long commands are formatted again whole, a change may come last
+    if (len >= (int)sizeof(buf)) {
+        text = (char*)malloc((size_t)len + 1);
+        if (text != NULL) {
+            vsnprintf(text, (size_t)len + 1, cmd, aq);
+        } else {
+            // not knowing is safe, the width is only asked again
+            handle->samples_width = 0;
+            handle->samples = 0;
+        }
+    }
+    va_end(aq);
+
+    for (const char* p = text; p != NULL; p = strchr(p, ';')) {
+        p += (*p == ';');
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        // a loaded file may change anything
+        if (strncmp(p, "reset", 5) == 0 || strncmp(p, "load", 4) == 0) {
+            handle->samples_width = 0;
+            handle->samples = 0;
+            continue;
+        }
+        int unset = (strncmp(p, "unset", 5) == 0 && (p[5] == ' ' || p[5] == '\t'));
+        if (!unset && (strncmp(p, "set", 3) != 0 || (p[3] != ' ' && p[3] != '\t')))
+            continue;
+        p += unset ? 5 : 3;
+        while (*p == ' ' || *p == '\t') {
+            p++;
+        }
+        if (strncmp(p, "te", 2) == 0 || strncmp(p, "si", 2) == 0)
+            handle->samples_width = 0;
+        if (strncmp(p, "sa", 2) == 0)
+            handle->samples = 0;
+    }
+    if (text != buf)
+        free(text);
+}
+
+/*
+ * Sets samples from the plot width, asking gnuplot for the width when it is
+ * not known.
+ */
+static void gnuplot_samples_update(gnuplot_ctrl* handle)
+{
+    if (handle->samples_width == 0) {
+        char answer[64];
+        int ret = gnuplot_roundtrip(handle,
+            "exists(\"GPVAL_TERM_SCALE\") ? (GPVAL_TERM_XMAX - GPVAL_TERM_XMIN) / GPVAL_TERM_SCALE : 0",
+            answer, sizeof(answer), GNUPLOT_SAMPLES_TIMEOUT_MS);
+        double width = (ret == 0) ? strtod(answer, NULL) : 0.0;
+        if (width >= 1.0)
+            handle->samples_width = (uint32_t)width;
+        else if (ret != 0)
+            // no answer will come, do not wait for it on every plot
+            handle->samples_width = GNUPLOT_SAMPLES_WIDTH;
+    }
+
+    uint32_t width = (handle->samples_width > 0) ? handle->samples_width : GNUPLOT_SAMPLES_WIDTH;
+    double samples = ceil(width * handle->samples_oversample);
+    samples = (samples < 2.0) ? 2.0 : (samples > GNUPLOT_SAMPLES_MAX) ? GNUPLOT_SAMPLES_MAX : samples;
+    if ((uint32_t)samples != handle->samples) {
+        gnuplot_cmd(handle, "set samples %u", (uint32_t)samples);
+        handle->samples = (uint32_t)samples;
+    }
+}
+
+void gnuplot_set_samples_auto(gnuplot_ctrl* handle, double oversample)
+{
+    handle->samples_oversample = (oversample > 0.0) ? oversample : 0.0;
+    handle->samples_width = 0;
+    handle->samples = 0;
+}
+
 void gnuplot_plot_equation(
     gnuplot_ctrl* handle,
     const char* equation,
@@ -366,9 +1349,3818 @@ void gnuplot_plot_equation(
     const char* cmd = (handle->multiplot == 0 && handle->nplots > 0) ? "replot" : "plot";
     title = (title == NULL) ? "(none)" : title;
 
+    if (handle->samples_oversample > 0.0)
+        gnuplot_samples_update(handle);
+
     gnuplot_cmd(handle, "%s %s title \"%s\" with %s",
         cmd, equation, title, handle->pstyle);
     handle->nplots++;
 }
 
+/*---------------------------------------------------------------------------
+                            Event loop
+ ---------------------------------------------------------------------------*/
+
+#ifdef _WIN32
+gnuplot_loop* gnuplot_loop_init(size_t quantum)
+{
+    (void)quantum;
+    return NULL;
+}
+
+int gnuplot_loop_add(gnuplot_loop* loop, gnuplot_ctrl* handle, uint32_t prio)
+{
+    (void)loop;
+    (void)handle;
+    (void)prio;
+    return -1;
+}
+
+void gnuplot_loop_remove(gnuplot_loop* loop, gnuplot_ctrl* handle)
+{
+    (void)loop;
+    (void)handle;
+}
+
+int gnuplot_loop_run(gnuplot_loop* loop, int timeout_ms)
+{
+    (void)loop;
+    (void)timeout_ms;
+    return -1;
+}
+
+size_t gnuplot_loop_pending(const gnuplot_ctrl* handle)
+{
+    (void)handle;
+    return 0;
+}
+
+void gnuplot_loop_close(gnuplot_loop* loop)
+{
+    (void)loop;
+}
+#else
+/*
+ * Appends to the queue of a handle in a loop, in place of writing to the pipe.
+ */
+static ssize_t gnuplot_queue_push(gnuplot_ctrl* handle, const char* buf, size_t size)
+{
+    if (handle->queue_tail + size > handle->queue_size && handle->queue_head > 0) {
+        memmove(handle->queue, handle->queue + handle->queue_head, handle->queue_tail - handle->queue_head);
+        handle->queue_tail -= handle->queue_head;
+        handle->queue_head = 0;
+    }
+    if (handle->queue_tail + size > handle->queue_size) {
+        size_t want = (handle->queue_size > 0) ? handle->queue_size : BUF_SIZE;
+        while (want < handle->queue_tail + size) {
+            want *= 2;
+        }
+        char* queue = (char*)realloc(handle->queue, want);
+        if (queue == NULL)
+            return -1;
+        handle->queue = queue;
+        handle->queue_size = want;
+    }
+
+    memcpy(handle->queue + handle->queue_tail, buf, size);
+    handle->queue_tail += size;
+
+    // interactive data goes out at once when the pipe has room
+    if (handle->prio == GNUPLOT_PRIO_INTERACTIVE)
+        gnuplot_queue_write(handle, SIZE_MAX);
+    return (ssize_t)size;
+}
+
+/*
+ * Writes up to max queued bytes, as many as the pipe takes without blocking.
+ * Returns the number of bytes written, -1 if the pipe is broken.
+ */
+static ssize_t gnuplot_queue_write(gnuplot_ctrl* handle, size_t max)
+{
+    size_t done = 0;
+
+    // over budget, the bytes wait in the queue
+    if (handle->budget_rate > 0 && handle->budget_policy == GNUPLOT_BUDGET_BLOCK) {
+        double tokens = gnuplot_budget_refill(handle);
+        max = (tokens < 1.0) ? 0 : (tokens < (double)max) ? (size_t)tokens : max;
+    }
+
+    while (done < max && handle->queue_head < handle->queue_tail) {
+        size_t size = handle->queue_tail - handle->queue_head;
+        size = (size < max - done) ? size : max - done;
+
+        uint64_t t = gnuplot_now();
+        ssize_t w = write(handle->fd, handle->queue + handle->queue_head, size);
+        t = gnuplot_now() - t;
+        if (w < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            // nobody will read these bytes anymore
+            handle->queue_head = handle->queue_tail = 0;
+            return -1;
+        }
+
+        gnuplot_hist_record(&handle->write_hist, t);
+        handle->stats.writes++;
+        handle->stats.bytes += (uint64_t)w;
+        handle->stats.write_ns += t;
+        handle->budget_tokens -= (double)w;
+        handle->queue_head += (size_t)w;
+        done += (size_t)w;
+    }
+    if (handle->queue_head == handle->queue_tail)
+        handle->queue_head = handle->queue_tail = 0;
+
+    return (ssize_t)done;
+}
+
+/*
+ * Writes the whole queue, waiting for the pipe as needed.
+ */
+static int gnuplot_queue_flush(gnuplot_ctrl* handle)
+{
+    while (handle->queue_head < handle->queue_tail) {
+        struct pollfd pfd = { handle->fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+            return -1;
+        if (handle->budget_rate > 0 && handle->budget_policy == GNUPLOT_BUDGET_BLOCK) {
+            size_t size = handle->queue_tail - handle->queue_head;
+            gnuplot_budget_wait(handle, (size < handle->budget_burst) ? size : (size_t)handle->budget_burst);
+        }
+        if (gnuplot_queue_write(handle, SIZE_MAX) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+gnuplot_loop* gnuplot_loop_init(size_t quantum)
+{
+    gnuplot_loop* loop = (gnuplot_loop*)calloc(1, sizeof(gnuplot_loop));
+
+    if (loop == NULL)
+        return NULL;
+    loop->quantum = (quantum > 0) ? quantum : GNUPLOT_LOOP_QUANTUM;
+    return loop;
+}
+
+int gnuplot_loop_add(gnuplot_loop* loop, gnuplot_ctrl* handle, uint32_t prio)
+{
+#ifndef __GLIBC__
+    // the pipe is a plain stdio stream, its writes cannot be queued
+    (void)loop;
+    (void)handle;
+    (void)prio;
+    return -1;
+#else
+    if (loop == NULL || handle == NULL || handle->loop != NULL || handle->fd < 0)
+        return -1;
+    if (loop->n == loop->size) {
+        uint32_t size = (loop->size > 0) ? loop->size * 2 : 8;
+        gnuplot_ctrl** handles = (gnuplot_ctrl**)realloc(loop->handles, size * sizeof(gnuplot_ctrl*));
+        struct pollfd* pfds = (struct pollfd*)realloc(loop->pfds, size * sizeof(struct pollfd));
+        if (handles != NULL)
+            loop->handles = handles;
+        if (pfds != NULL)
+            loop->pfds = pfds;
+        if (handles == NULL || pfds == NULL)
+            return -1;
+        loop->size = size;
+    }
+
+    // what stdio holds goes first, then every write is queued
+    fflush(handle->gnucmd);
+    fcntl(handle->fd, F_SETFL, fcntl(handle->fd, F_GETFL) | O_NONBLOCK);
+    handle->loop = loop;
+    handle->prio = prio;
+    loop->handles[loop->n++] = handle;
+
+    return 0;
+#endif // #ifndef __GLIBC__
+}
+
+void gnuplot_loop_remove(gnuplot_loop* loop, gnuplot_ctrl* handle)
+{
+    if (loop == NULL || handle == NULL || handle->loop != loop)
+        return;
+
+    fflush(handle->gnucmd);
+    gnuplot_queue_flush(handle);
+    fcntl(handle->fd, F_SETFL, fcntl(handle->fd, F_GETFL) & ~O_NONBLOCK);
+    handle->loop = NULL;
+    free(handle->queue);
+    handle->queue = NULL;
+    handle->queue_size = 0;
+
+    for (uint32_t i = 0; i < loop->n; i++) {
+        if (loop->handles[i] == handle) {
+            loop->handles[i] = loop->handles[--loop->n];
+            break;
+        }
+    }
+    loop->next = 0;
+}
+
+/*
+ * Interactive handles take all they can, whenever the loop gets a chance.
+ */
+static int gnuplot_loop_interactive(gnuplot_loop* loop)
+{
+    int ret = 0;
+
+    for (uint32_t i = 0; i < loop->n; i++) {
+        gnuplot_ctrl* handle = loop->handles[i];
+        if (handle->prio == GNUPLOT_PRIO_INTERACTIVE && handle->queue_head < handle->queue_tail
+            && gnuplot_queue_write(handle, SIZE_MAX) < 0)
+            ret = -1;
+    }
+
+    return ret;
+}
+
+int gnuplot_loop_run(gnuplot_loop* loop, int timeout_ms)
+{
+    uint64_t deadline = gnuplot_now() + (uint64_t)timeout_ms * 1000000;
+    int ret = 0;
+
+    for (;;) {
+        uint32_t npfds = 0;
+        uint32_t throttled = 0;
+        uint64_t refill = UINT64_MAX;
+        for (uint32_t i = 0; i < loop->n; i++) {
+            gnuplot_ctrl* handle = loop->handles[i];
+            // the data stdio holds has to be queued to count
+            fflush(handle->gnucmd);
+            if (handle->queue_head == handle->queue_tail)
+                continue;
+            // out of budget, the handle waits for its next byte instead of a writable pipe
+            if (handle->budget_rate > 0 && handle->budget_policy == GNUPLOT_BUDGET_BLOCK) {
+                double tokens = gnuplot_budget_refill(handle);
+                if (tokens < 1.0) {
+                    uint64_t ns = (uint64_t)((1.0 - tokens) * 1e9 / (double)handle->budget_rate) + 1;
+                    refill = (ns < refill) ? ns : refill;
+                    throttled++;
+                    continue;
+                }
+            }
+            loop->pfds[npfds].fd = handle->fd;
+            loop->pfds[npfds].events = POLLOUT;
+            loop->pfds[npfds].revents = 0;
+            npfds++;
+        }
+        if (npfds == 0 && throttled == 0)
+            return ret;
+
+        int wait = -1;
+        uint64_t t = gnuplot_now();
+        if (timeout_ms >= 0)
+            wait = (t >= deadline) ? 0 : (int)((deadline - t + 999999) / 1000000);
+        if (throttled > 0) {
+            int ms = (refill < (uint64_t)INT_MAX * 1000000) ? (int)((refill + 999999) / 1000000) : INT_MAX;
+            wait = (wait < 0 || ms < wait) ? ms : wait;
+        }
+        int ready = poll(loop->pfds, npfds, wait);
+        if (ready < 0 && errno != EINTR)
+            return -1;
+        if (throttled > 0) {
+            t = gnuplot_now() - t;
+            for (uint32_t i = 0; i < loop->n; i++) {
+                gnuplot_ctrl* handle = loop->handles[i];
+                if (handle->queue_head < handle->queue_tail && handle->budget_rate > 0
+                    && handle->budget_policy == GNUPLOT_BUDGET_BLOCK && handle->budget_tokens < 1.0)
+                    handle->stats.throttled_ns += t;
+            }
+        }
+        if (ready == 0 && timeout_ms >= 0 && gnuplot_now() >= deadline)
+            return (ret < 0) ? ret : 1;
+
+        if (gnuplot_loop_interactive(loop) < 0)
+            ret = -1;
+
+        // a quantum per batch handle, round robin, interactive ones served in between
+        for (uint32_t k = 0; k < loop->n; k++) {
+            gnuplot_ctrl* handle = loop->handles[(loop->next + k) % loop->n];
+            if (handle->prio == GNUPLOT_PRIO_INTERACTIVE || handle->queue_head == handle->queue_tail)
+                continue;
+            if (gnuplot_queue_write(handle, loop->quantum) < 0)
+                ret = -1;
+            if (gnuplot_loop_interactive(loop) < 0)
+                ret = -1;
+        }
+        loop->next = (loop->n > 0) ? (loop->next + 1) % loop->n : 0;
+
+        if (timeout_ms >= 0 && gnuplot_now() >= deadline) {
+            for (uint32_t i = 0; i < loop->n; i++) {
+                if (loop->handles[i]->queue_head < loop->handles[i]->queue_tail)
+                    return (ret < 0) ? ret : 1;
+            }
+            return ret;
+        }
+    }
+}
+
+size_t gnuplot_loop_pending(const gnuplot_ctrl* handle)
+{
+    return handle->queue_tail - handle->queue_head;
+}
+
+void gnuplot_loop_close(gnuplot_loop* loop)
+{
+    if (loop == NULL)
+        return;
+    while (loop->n > 0) {
+        gnuplot_loop_remove(loop, loop->handles[loop->n - 1]);
+    }
+    free(loop->handles);
+    free(loop->pfds);
+    free(loop);
+}
+#endif // #ifdef _WIN32
+
+/*---------------------------------------------------------------------------
+                            Session templates
+ ---------------------------------------------------------------------------*/
+
+gnuplot_template* gnuplot_template_init(void)
+{
+    return (gnuplot_template*)calloc(1, sizeof(gnuplot_template));
+}
+
+int gnuplot_template_cmd(gnuplot_template* tpl, const char* cmd, ...)
+{
+    va_list ap;
+
+    if (tpl->path[0] != '\0') {
+        fprintf(stderr, "cannot add to a template already applied\n");
+        return -1;
+    }
+
+    va_start(ap, cmd);
+    int len = vsnprintf(NULL, 0, cmd, ap);
+    va_end(ap);
+    if (len < 0)
+        return -1;
+    if (tpl->len + (size_t)len + 2 > tpl->size) {
+        size_t size = (tpl->size > 0) ? tpl->size : 1024;
+        while (size < tpl->len + (size_t)len + 2) {
+            size *= 2;
+        }
+        char* text = (char*)realloc(tpl->text, size);
+        if (text == NULL)
+            return -1;
+        tpl->text = text;
+        tpl->size = size;
+    }
+
+    va_start(ap, cmd);
+    vsnprintf(tpl->text + tpl->len, (size_t)len + 1, cmd, ap);
+    va_end(ap);
+    tpl->len += (size_t)len;
+    tpl->text[tpl->len++] = '\n';
+    tpl->text[tpl->len] = '\0';
+    return 0;
+}
+
+#ifndef _WIN32
+/*
+ * Creates a file for gnuplot to read or write, in memory when /dev/shm is
+ * there. Returns its descriptor, -1 on error.
+ */
+static int gnuplot_tmp_file(char* path, size_t len)
+{
+    const char* dir = getenv("TMPDIR");
+
+    if (access("/dev/shm", W_OK) == 0)
+        dir = "/dev/shm";
+    else if (dir == NULL || strlen(dir) + 20 > len)
+        dir = "/tmp";
+    snprintf(path, len, "%s/gnuplot_i-XXXXXX", dir);
+
+    return mkstemp(path);
+}
+
+/*
+ * Writes the commands of a template to its file.
+ */
+static int gnuplot_template_write(gnuplot_template* tpl)
+{
+    int fd = gnuplot_tmp_file(tpl->path, sizeof(tpl->path));
+    if (fd < 0) {
+        tpl->path[0] = '\0';
+        return -1;
+    }
+    for (size_t done = 0; done < tpl->len;) {
+        ssize_t w = write(fd, tpl->text + done, tpl->len - done);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0) {
+            close(fd);
+            unlink(tpl->path);
+            tpl->path[0] = '\0';
+            return -1;
+        }
+        done += (size_t)w;
+    }
+    close(fd);
+    return 0;
+}
+#endif // #ifndef _WIN32
+
+int gnuplot_template_apply(gnuplot_ctrl* handle, gnuplot_template* tpl)
+{
+    if (handle == NULL || tpl == NULL)
+        return -1;
+    handle->tmpl = tpl;
+    if (tpl->len == 0)
+        return 0;
+
+#ifdef _WIN32
+    // no shared file, the commands go through the pipe
+    fwrite(tpl->text, 1, tpl->len, handle->gnucmd);
+    fflush(handle->gnucmd);
+#else
+    if (tpl->path[0] == '\0' && gnuplot_template_write(tpl) != 0) {
+        fprintf(stderr, "cannot write the template file\n");
+        return -1;
+    }
+    gnuplot_cmd(handle, "load \"%s\"", tpl->path);
+#endif // #ifdef _WIN32
+
+    return 0;
+}
+
+void gnuplot_template_close(gnuplot_template* tpl)
+{
+    if (tpl == NULL)
+        return;
+#ifndef _WIN32
+    if (tpl->path[0] != '\0')
+        unlink(tpl->path);
+#endif // #ifndef _WIN32
+    free(tpl->text);
+    free(tpl);
+}
+
+/*---------------------------------------------------------------------------
+                        Session pool and gnuplotd
+ ---------------------------------------------------------------------------*/
+
+gnuplot_pool* gnuplot_pool_init(uint32_t size)
+{
+    gnuplot_pool* pool;
+
+    pool = (gnuplot_pool*)calloc(1, sizeof(gnuplot_pool));
+    pool->idle = (gnuplot_ctrl**)malloc(sizeof(gnuplot_ctrl*) * (size > 0 ? size : 1));
+    pool->size = size;
+
+    for (uint32_t i = 0; i < size; i++) {
+        gnuplot_ctrl* handle = gnuplot_init();
+        if (handle == NULL) {
+            gnuplot_pool_close(pool);
+            return NULL;
+        }
+        // remember the default terminal, restored on release
+        gnuplot_cmd(handle, "set terminal push");
+        pool->idle[pool->nidle++] = handle;
+    }
+
+    return pool;
+}
+
+gnuplot_ctrl* gnuplot_pool_acquire(gnuplot_pool* pool)
+{
+    gnuplot_ctrl* handle;
+
+    if (pool->nidle == 0) {
+        handle = gnuplot_init();
+        if (handle != NULL) {
+            gnuplot_cmd(handle, "set terminal push");
+            if (pool->tmpl != NULL)
+                gnuplot_template_apply(handle, pool->tmpl);
+        }
+        return handle;
+    }
+
+    return pool->idle[--pool->nidle];
+}
+
+void gnuplot_pool_release(gnuplot_pool* pool, gnuplot_ctrl* handle)
+{
+    if (pool->nidle >= pool->size) {
+        gnuplot_close(handle);
+        return;
+    }
+
+#ifndef _WIN32
+    // drop answers nobody read, they would fill the pipe in the long run
+    char buf[256];
+    int flags = fcntl(handle->ack, F_GETFL);
+    fcntl(handle->ack, F_SETFL, flags | O_NONBLOCK);
+    while (read(handle->ack, buf, sizeof(buf)) > 0)
+        ;
+    fcntl(handle->ack, F_SETFL, flags);
+#endif // #ifndef _WIN32
+
+    gnuplot_cmd(handle, "unset multiplot");
+    gnuplot_cmd(handle, "unset output");
+    gnuplot_cmd(handle, "set terminal pop");
+    gnuplot_cmd(handle, "reset session");
+    handle->nplots = 0;
+    handle->multiplot = 0;
+    gnuplot_setstyle(handle, "points");
+    handle->tmpl = NULL;
+    if (pool->tmpl != NULL)
+        gnuplot_template_apply(handle, pool->tmpl);
+
+    pool->idle[pool->nidle++] = handle;
+}
+
+/*
+ * Kill a session whose state is unknown, and warm up a new one in its place.
+ */
+static void gnuplot_pool_discard(gnuplot_pool* pool, gnuplot_ctrl* handle)
+{
+    gnuplot_reap(handle, 1);
+    gnuplot_free(handle);
+
+    if (pool->nidle < pool->size) {
+        gnuplot_ctrl* spare = gnuplot_init();
+        if (spare != NULL) {
+            gnuplot_cmd(spare, "set terminal push");
+            if (pool->tmpl != NULL)
+                gnuplot_template_apply(spare, pool->tmpl);
+            pool->idle[pool->nidle++] = spare;
+        }
+    }
+}
+
+void gnuplot_pool_set_template(gnuplot_pool* pool, gnuplot_template* tpl)
+{
+    pool->tmpl = tpl;
+    for (uint32_t i = 0; i < pool->nidle; i++) {
+        pool->idle[i]->tmpl = NULL;
+        if (tpl != NULL)
+            gnuplot_template_apply(pool->idle[i], tpl);
+    }
+}
+
+void gnuplot_pool_close(gnuplot_pool* pool)
+{
+    for (uint32_t i = 0; i < pool->nidle; i++) {
+        gnuplot_close(pool->idle[i]);
+    }
+    free(pool->idle);
+    free(pool);
+}
+
+#ifndef _WIN32
+static int gnuplot_msg_send(int sock, uint32_t op, int32_t pid, const int* fds, int nfds)
+{
+    gnuplot_msg msg = { op, pid };
+    struct iovec iov = { &msg, sizeof(msg) };
+    struct msghdr mh;
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    if (nfds > 0) {
+        mh.msg_control = ctl.buf;
+        mh.msg_controllen = CMSG_SPACE(nfds * sizeof(int));
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(nfds * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), fds, nfds * sizeof(int));
+    }
+
+    return sendmsg(sock, &mh, MSG_NOSIGNAL) == (ssize_t)sizeof(msg) ? 0 : -1;
+}
+
+/*
+ * Returns the number of file descriptors received, -1 on error or when the
+ * peer is gone.
+ */
+static int gnuplot_msg_recv(int sock, gnuplot_msg* msg, int* fds, int nfds)
+{
+    struct iovec iov = { msg, sizeof(gnuplot_msg) };
+    struct msghdr mh;
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        struct cmsghdr align;
+    } ctl;
+    ssize_t r;
+
+    memset(&mh, 0, sizeof(mh));
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = ctl.buf;
+    mh.msg_controllen = sizeof(ctl.buf);
+
+    do {
+        r = recvmsg(sock, &mh, MSG_CMSG_CLOEXEC);
+    } while (r < 0 && errno == EINTR);
+    if (r != (ssize_t)sizeof(gnuplot_msg))
+        return -1;
+
+    int n = 0;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&mh); cmsg != NULL; cmsg = CMSG_NXTHDR(&mh, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+        int count = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        int* received = (int*)CMSG_DATA(cmsg);
+        for (int i = 0; i < count; i++) {
+            if (n < nfds)
+                fds[n++] = received[i];
+            else
+                close(received[i]);
+        }
+    }
+
+    return n;
+}
+
+static int gnuplot_daemon_connect(const char* path)
+{
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (sock < 0)
+        return -1;
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(sock);
+        return -1;
+    }
+
+    return sock;
+}
+
+/*
+ * Get a worker from gnuplotd. The daemon hands over the pipes of the worker
+ * itself, so commands and data go straight to gnuplot, never through the
+ * socket nor the daemon.
+ */
+static int gnuplot_daemon_acquire(gnuplot_ctrl* handle)
+{
+    gnuplot_msg msg;
+    int fds[2];
+
+    if (gnuplot_msg_send(handle->daemon, GNUPLOTD_ACQUIRE, 0, NULL, 0) != 0)
+        return -1;
+    int n = gnuplot_msg_recv(handle->daemon, &msg, fds, 2);
+    if (n < 0)
+        return -1;
+    if (msg.op != GNUPLOTD_WORKER || n != 2) {
+        for (int i = 0; i < n; i++) {
+            close(fds[i]);
+        }
+        return -1;
+    }
+
+    handle->gnucmd = gnuplot_open_pipe(handle, fds[0]);
+    if (handle->gnucmd == NULL) {
+        close(fds[0]);
+        close(fds[1]);
+        gnuplot_msg_send(handle->daemon, GNUPLOTD_DISCARD, 0, NULL, 0);
+        return -1;
+    }
+    setvbuf(handle->gnucmd, handle->BUF, _IOFBF, BUF_SIZE);
+    handle->ack = fds[1];
+    handle->pid = msg.pid;
+
+    return 0;
+}
+
+static int gnuplot_daemon_release(gnuplot_ctrl* handle, int force)
+{
+    // a worker with our scheduling would degrade the next client, and the
+    // daemon may lack the privileges to undo it: let it finish, then kill it
+    if (!force && handle->resched) {
+        gnuplot_sync(handle, -1);
+        force = 1;
+    }
+    handle->resched = 0;
+    if (force) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) {
+            dup2(null, handle->fd);
+            close(null);
+        }
+    }
+    fclose(handle->gnucmd);
+    handle->gnucmd = NULL;
+    close(handle->ack);
+    handle->ack = -1;
+    handle->pid = 0;
+
+    return gnuplot_msg_send(handle->daemon, force ? GNUPLOTD_DISCARD : GNUPLOTD_RELEASE, 0, NULL, 0);
+}
+#endif // #ifndef _WIN32
+
+int gnuplot_pool_serve(gnuplot_pool* pool, const char* path)
+{
+#ifdef _WIN32
+    (void)pool;
+    (void)path;
+    return -1;
+#else
+    struct sockaddr_un addr;
+    struct pollfd* pfds;
+    gnuplot_ctrl** workers;
+    uint32_t n = 1;
+    uint32_t cap = 16;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long: %s\n", path);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int lsock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (lsock < 0)
+        return -1;
+    unlink(path);
+    mode_t mask = umask(0077);
+    int ret = bind(lsock, (struct sockaddr*)&addr, sizeof(addr));
+    umask(mask);
+    if (ret != 0 || listen(lsock, 64) != 0) {
+        fprintf(stderr, "cannot listen on %s: %s\n", path, strerror(errno));
+        close(lsock);
+        return -1;
+    }
+
+    // entry 0 is the listening socket, then one entry per client
+    pfds = (struct pollfd*)malloc(sizeof(struct pollfd) * cap);
+    workers = (gnuplot_ctrl**)malloc(sizeof(gnuplot_ctrl*) * cap);
+    pfds[0].fd = lsock;
+    pfds[0].events = POLLIN;
+    workers[0] = NULL;
+
+    for (;;) {
+        if (poll(pfds, n, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (uint32_t i = n - 1; i > 0; i--) {
+            if (pfds[i].revents == 0)
+                continue;
+
+            gnuplot_msg msg;
+            int sock = pfds[i].fd;
+            if (!(pfds[i].revents & POLLIN) || gnuplot_msg_recv(sock, &msg, NULL, 0) < 0) {
+                // client gone: its worker may be in the middle of anything
+                if (workers[i] != NULL)
+                    gnuplot_pool_discard(pool, workers[i]);
+                close(sock);
+                n--;
+                pfds[i] = pfds[n];
+                workers[i] = workers[n];
+                continue;
+            }
+
+            switch (msg.op) {
+            case GNUPLOTD_ACQUIRE:
+                if (workers[i] == NULL)
+                    workers[i] = gnuplot_pool_acquire(pool);
+                if (workers[i] == NULL) {
+                    gnuplot_msg_send(sock, GNUPLOTD_ERROR, 0, NULL, 0);
+                } else {
+                    int fds[2] = { workers[i]->fd, workers[i]->ack };
+                    fflush(workers[i]->gnucmd);
+                    gnuplot_msg_send(sock, GNUPLOTD_WORKER, workers[i]->pid, fds, 2);
+                }
+                break;
+            case GNUPLOTD_RELEASE:
+                if (workers[i] != NULL)
+                    gnuplot_pool_release(pool, workers[i]);
+                workers[i] = NULL;
+                break;
+            case GNUPLOTD_DISCARD:
+                if (workers[i] != NULL)
+                    gnuplot_pool_discard(pool, workers[i]);
+                workers[i] = NULL;
+                break;
+            default:
+                break;
+            }
+        }
+
+        if (pfds[0].revents & POLLIN) {
+            int sock = accept4(lsock, NULL, NULL, SOCK_CLOEXEC);
+            if (sock >= 0) {
+                if (n == cap) {
+                    cap *= 2;
+                    pfds = (struct pollfd*)realloc(pfds, sizeof(struct pollfd) * cap);
+                    workers = (gnuplot_ctrl**)realloc(workers, sizeof(gnuplot_ctrl*) * cap);
+                }
+                pfds[n].fd = sock;
+                pfds[n].events = POLLIN;
+                pfds[n].revents = 0;
+                workers[n] = NULL;
+                n++;
+            }
+        }
+    }
+
+    for (uint32_t i = 1; i < n; i++) {
+        if (workers[i] != NULL)
+            gnuplot_pool_discard(pool, workers[i]);
+        close(pfds[i].fd);
+    }
+    free(pfds);
+    free(workers);
+    close(lsock);
+    unlink(path);
+    return -1;
+#endif // #ifdef _WIN32
+}
+
+/*---------------------------------------------------------------------------
+                            Scheduling
+ ---------------------------------------------------------------------------*/
+
+/*
+ * Applies sched to the process or thread id, oom_score_adj being only
+ * applied to processes. Returns -1 if a setting failed.
+ */
+static int gnuplot_sched_apply(const gnuplot_sched* sched, int32_t id, int process)
+{
+#ifdef __linux__
+    int ret = 0;
+
+    if (sched->flags & GNUPLOT_SCHED_AFFINITY) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < GNUPLOT_SCHED_CPUS && cpu < CPU_SETSIZE; cpu++) {
+            if ((sched->cpus[cpu / 64] >> (cpu % 64)) & 1)
+                CPU_SET(cpu, &set);
+        }
+        ret |= sched_setaffinity((pid_t)id, sizeof(set), &set);
+    }
+    if (sched->flags & GNUPLOT_SCHED_IDLE) {
+        struct sched_param param = { 0 };
+        ret |= sched_setscheduler((pid_t)id, SCHED_IDLE, &param);
+    }
+    // on Linux the nice value of a thread id is the one of the thread only
+    if (sched->flags & GNUPLOT_SCHED_NICE)
+        ret |= setpriority(PRIO_PROCESS, (id_t)id, sched->nice);
+    if (process && (sched->flags & GNUPLOT_SCHED_OOM)) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/oom_score_adj", (int)id);
+        FILE* f = fopen(path, "w");
+        if (f == NULL || fprintf(f, "%d", (int)sched->oom_score_adj) < 0)
+            ret = -1;
+        if (f != NULL && fclose(f) != 0)
+            ret = -1;
+    }
+
+    return (ret != 0) ? -1 : 0;
+#else
+    (void)sched;
+    (void)id;
+    (void)process;
+    return -1;
+#endif // #ifdef __linux__
+}
+
+/*
+ * Applies the default settings to the calling thread, one the library
+ * started.
+ */
+static void gnuplot_sched_thread(void)
+{
+#ifdef __linux__
+    if (gnuplot_default_sched.flags != 0)
+        gnuplot_sched_apply(&gnuplot_default_sched, (int32_t)syscall(SYS_gettid), 0);
+#endif // #ifdef __linux__
+}
+
+void gnuplot_set_default_sched(const gnuplot_sched* sched)
+{
+    if (sched == NULL)
+        memset(&gnuplot_default_sched, 0, sizeof(gnuplot_default_sched));
+    else
+        gnuplot_default_sched = *sched;
+}
+
+int gnuplot_set_sched(gnuplot_ctrl* handle, const gnuplot_sched* sched)
+{
+    if (handle == NULL)
+        return -1;
+    if (sched == NULL)
+        memset(&handle->sched, 0, sizeof(handle->sched));
+    else
+        handle->sched = *sched;
+    if (handle->sched.flags == 0)
+        return 0;
+    if (handle->pid <= 0)
+        return -1;
+    handle->resched = (handle->daemon >= 0);
+    return gnuplot_sched_apply(&handle->sched, handle->pid, 1);
+}
+
+/*---------------------------------------------------------------------------
+                            Parallel helpers
+ ---------------------------------------------------------------------------*/
+
+/*
+ * Number of threads worth using for work items, each thread needing scratch
+ * bytes of its own.
+ */
+static uint32_t gnuplot_nthreads(uint64_t work, size_t scratch)
+{
+    uint64_t n = 1;
+
+#ifndef _WIN32
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    n = (cpus > 0) ? (uint64_t)cpus : 1;
+#endif // #ifndef _WIN32
+    if (n > GNUPLOT_MAX_THREADS)
+        n = GNUPLOT_MAX_THREADS;
+    if (n > work)
+        n = (work > 0) ? work : 1;
+    if (scratch > 0 && n * scratch > GNUPLOT_MAX_SCRATCH)
+        n = (GNUPLOT_MAX_SCRATCH / scratch > 0) ? GNUPLOT_MAX_SCRATCH / scratch : 1;
+
+    return (uint32_t)n;
+}
+
+#ifndef _WIN32
+static void* gnuplot_task_run(void* p)
+{
+    gnuplot_task* task = (gnuplot_task*)p;
+
+    gnuplot_sched_thread();
+    task->fn(task->arg, task->index);
+    return NULL;
+}
+#endif // #ifndef _WIN32
+
+/*
+ * Run fn(arg, i) for i in [0, nthreads), each on its own thread. The calling
+ * thread runs index 0. Indices whose thread cannot be created run on the
+ * calling thread too, so fn must not wait for other indices.
+ */
+static void gnuplot_parallel(uint32_t nthreads, void (*fn)(void* arg, uint32_t index), void* arg)
+{
+#ifdef _WIN32
+    for (uint32_t i = 0; i < nthreads; i++) {
+        fn(arg, i);
+    }
+#else
+    pthread_t threads[GNUPLOT_MAX_THREADS];
+    gnuplot_task tasks[GNUPLOT_MAX_THREADS];
+    int started[GNUPLOT_MAX_THREADS];
+
+    if (nthreads > GNUPLOT_MAX_THREADS)
+        nthreads = GNUPLOT_MAX_THREADS;
+    for (uint32_t i = 1; i < nthreads; i++) {
+        tasks[i].fn = fn;
+        tasks[i].arg = arg;
+        tasks[i].index = i;
+        started[i] = pthread_create(&threads[i], NULL, gnuplot_task_run, &tasks[i]) == 0;
+        if (!started[i])
+            fn(arg, i);
+    }
+    fn(arg, 0);
+    for (uint32_t i = 1; i < nthreads; i++) {
+        if (started[i])
+            pthread_join(threads[i], NULL);
+    }
+#endif // #ifdef _WIN32
+}
+
+/*---------------------------------------------------------------------------
+                            Level of detail
+ ---------------------------------------------------------------------------*/
+
+/*
+ * Sends the points of a series as an inline block, x being the index when
+ * NULL. Above target points (0 for no limit), the series is cut in target / 2
+ * buckets of which the smallest and the largest y are sent, in their order,
+ * so that peaks survive. Returns the number of points sent.
+ */
+static uint64_t gnuplot_send_series(gnuplot_ctrl* handle, const double* x, const double* y, uint32_t n, uint32_t target)
+{
+    uint64_t sent = 0;
+
+    if (target == 0 || n <= target) {
+        for (uint32_t i = 0; i < n; i++) {
+            if (x == NULL)
+                gnuplot_printf(handle, "%18e", y[i]);
+            else
+                gnuplot_printf(handle, "%18e %18e", x[i], y[i]);
+        }
+        sent = n;
+    } else {
+        uint32_t buckets = (target / 2 > 0) ? target / 2 : 1;
+        for (uint32_t b = 0; b < buckets; b++) {
+            uint32_t begin = (uint32_t)((uint64_t)n * b / buckets);
+            uint32_t end = (uint32_t)((uint64_t)n * (b + 1) / buckets);
+            uint32_t lo = begin;
+            uint32_t hi = begin;
+            for (uint32_t i = begin + 1; i < end; i++) {
+                lo = (y[i] < y[lo]) ? i : lo;
+                hi = (y[i] > y[hi]) ? i : hi;
+            }
+            uint32_t first = (lo < hi) ? lo : hi;
+            uint32_t second = (lo < hi) ? hi : lo;
+            gnuplot_printf(handle, "%18e %18e", (x != NULL) ? x[first] : (double)first, y[first]);
+            sent++;
+            if (second != first) {
+                gnuplot_printf(handle, "%18e %18e", (x != NULL) ? x[second] : (double)second, y[second]);
+                sent++;
+            }
+        }
+    }
+    gnuplot_cmd(handle, "e");
+
+    return sent;
+}
+
+/*
+ * Points allowed to each of l series of a frame, the longest having n, 0 for
+ * no limit.
+ */
+static uint32_t gnuplot_lod_target(gnuplot_ctrl* handle, uint32_t l, uint32_t n)
+{
+    uint32_t target = 0;
+
+    if (handle->lod_budget_ns > 0) {
+        target = handle->lod_points / l;
+        target = (target > 2) ? target : 2;
+    }
+    if (handle->budget_rate > 0 && handle->budget_policy == GNUPLOT_BUDGET_DECIMATE) {
+        double tokens = gnuplot_budget_refill(handle);
+        double points = tokens / (GNUPLOT_BUDGET_POINT_BYTES * l);
+        uint32_t fit = (points > GNUPLOT_BUDGET_MIN_POINTS) ? (points < UINT32_MAX ? (uint32_t)points : UINT32_MAX)
+                                                            : GNUPLOT_BUDGET_MIN_POINTS;
+        target = (target == 0 || fit < target) ? fit : target;
+        handle->stats.decimated += (fit < n);
+    }
+    return target;
+}
+
+/*
+ * Adds the tokens earned since they were last counted, up to the burst, and
+ * returns them.
+ */
+static double gnuplot_budget_refill(gnuplot_ctrl* handle)
+{
+    uint64_t now = gnuplot_now();
+
+    handle->budget_tokens += (double)(now - handle->budget_last) * (double)handle->budget_rate / 1e9;
+    if (handle->budget_tokens > (double)handle->budget_burst)
+        handle->budget_tokens = (double)handle->budget_burst;
+    handle->budget_last = now;
+    return handle->budget_tokens;
+}
+
+#ifndef _WIN32
+/*
+ * Sleeps until the budget has size bytes, size being at most the burst.
+ */
+static void gnuplot_budget_wait(gnuplot_ctrl* handle, size_t size)
+{
+    double missing = (double)size - gnuplot_budget_refill(handle);
+
+    if (missing <= 0.0)
+        return;
+    uint64_t t = gnuplot_now();
+    uint64_t ns = (uint64_t)(missing * 1e9 / (double)handle->budget_rate);
+    struct timespec ts = { (time_t)(ns / 1000000000), (long)(ns % 1000000000) };
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+    handle->stats.throttled_ns += gnuplot_now() - t;
+    gnuplot_budget_refill(handle);
+}
+#endif // #ifndef _WIN32
+
+/*
+ * Decides whether a frame of the inline plot functions goes out. Returns 0
+ * if it is dropped for lack of budget.
+ */
+static int gnuplot_budget_frame(gnuplot_ctrl* handle)
+{
+    if (handle->budget_rate == 0 || handle->budget_policy == GNUPLOT_BUDGET_BLOCK)
+        return 1;
+
+    double tokens = gnuplot_budget_refill(handle);
+    if (handle->budget_policy == GNUPLOT_BUDGET_DROP && tokens <= 0.0) {
+        handle->stats.dropped++;
+        return 0;
+    }
+    return 1;
+}
+
+void gnuplot_set_budget(gnuplot_ctrl* handle, uint64_t rate, uint64_t burst, uint32_t policy)
+{
+    handle->budget_rate = rate;
+    handle->budget_burst = (burst > 0) ? burst : rate;
+    handle->budget_policy = policy;
+    handle->budget_tokens = (double)handle->budget_burst;
+    handle->budget_last = gnuplot_now();
+}
+
+/*
+ * Waits for gnuplot to have read a frame of sent points started at t, and
+ * sets the points of the next frame from the rate gnuplot took them at.
+ */
+static void gnuplot_lod_update(gnuplot_ctrl* handle, uint64_t t, uint64_t sent)
+{
+    if (handle->lod_budget_ns == 0 || sent == 0)
+        return;
+
+    // a frame gnuplot does not finish within 4 budgets counts as taking 4
+    int timeout_ms = (int)(handle->lod_budget_ns * 4 / 1000000) + 1;
+    gnuplot_sync(handle, timeout_ms);
+    uint64_t elapsed = gnuplot_now() - t;
+
+    double rate = (double)sent / (double)(elapsed > 0 ? elapsed : 1);
+    handle->lod_rate = (handle->lod_rate > 0.0) ? 0.7 * handle->lod_rate + 0.3 * rate : rate;
+
+    // frames have fixed costs, so when well within budget detail is raised
+    // further than the rate alone says, up to twice per frame
+    double points = handle->lod_rate * (double)handle->lod_budget_ns;
+    if (elapsed < handle->lod_budget_ns / 2 && points < 2.0 * handle->lod_points)
+        points = 2.0 * handle->lod_points;
+    if (points > 2.0 * handle->lod_points && handle->lod_points > 0)
+        points = 2.0 * handle->lod_points;
+    if (points < handle->lod_min)
+        points = handle->lod_min;
+    if (points > handle->lod_max)
+        points = handle->lod_max;
+    handle->lod_points = (uint32_t)points;
+}
+
+void gnuplot_set_lod(gnuplot_ctrl* handle, uint32_t budget_ms, uint32_t min_points, uint32_t max_points)
+{
+    handle->lod_budget_ns = (uint64_t)budget_ms * 1000000;
+    handle->lod_min = (min_points > 2) ? min_points : 2;
+    handle->lod_max = (max_points > handle->lod_min) ? max_points : handle->lod_min;
+    handle->lod_points = handle->lod_max;
+    handle->lod_rate = 0.0;
+}
+
+uint32_t gnuplot_get_lod(const gnuplot_ctrl* handle)
+{
+    return (handle->lod_budget_ns > 0) ? handle->lod_points : 0;
+}
+
+/*---------------------------------------------------------------------------
+                            Resampling
+ ---------------------------------------------------------------------------*/
+
+/*
+ * Value of a series at xq, cursor being the last sample at or before the
+ * previous xq. Queries must come in increasing order.
+ */
+static inline double gnuplot_resample_at(
+    const double* x,
+    const double* y,
+    uint32_t n,
+    uint32_t* cursor,
+    double xq,
+    uint32_t method)
+{
+    uint32_t c = *cursor;
+
+    while (c + 1 < n && x[c + 1] <= xq) {
+        c++;
+    }
+    *cursor = c;
+
+    if (xq < x[0])
+        return NAN;
+    if (c + 1 == n) {
+        if (method == GNUPLOT_RESAMPLE_PREVIOUS || xq == x[c])
+            return y[c];
+        return NAN;
+    }
+    switch (method) {
+    case GNUPLOT_RESAMPLE_PREVIOUS:
+        return y[c];
+    case GNUPLOT_RESAMPLE_NEAREST:
+        return (xq - x[c] <= x[c + 1] - xq) ? y[c] : y[c + 1];
+    default:
+        return y[c] + (y[c + 1] - y[c]) * (xq - x[c]) / (x[c + 1] - x[c]);
+    }
+}
+
+uint32_t gnuplot_resample(
+    const double* x,
+    const double* y,
+    uint32_t n,
+    const double* grid,
+    uint32_t m,
+    uint32_t method,
+    double* out)
+{
+    uint32_t cursor = 0;
+    uint32_t defined = 0;
+
+    if (x == NULL || y == NULL || grid == NULL || out == NULL || (n < 1))
+        return 0;
+    for (uint32_t j = 0; j < m; j++) {
+        out[j] = gnuplot_resample_at(x, y, n, &cursor, grid[j], method);
+        defined += !isnan(out[j]);
+    }
+
+    return defined;
+}
+
+/*
+ * Starts the definition of a datablock, to be ended by a line "EOD". Blocks
+ * are named after their order since the last gnuplot_resetplot(), so that
+ * gnuplot does not keep more of them than there are plots on screen.
+ */
+static void gnuplot_datablock(gnuplot_ctrl* handle, char* name, size_t len)
+{
+    snprintf(name, len, "$gpi_%u", handle->nblocks++);
+    gnuplot_cmd(handle, "%s << EOD", name);
+}
+
+/*
+ * Plots columns 2 to l + 1 of a datablock against column 1.
+ */
+static void gnuplot_plot_block(gnuplot_ctrl* handle, const char* cmd, const char* name, uint32_t l, const char** title)
+{
+    for (uint32_t i = 0; i < l; i++) {
+        const char* t = (title == NULL || title[i] == NULL) ? "(none)" : title[i];
+        if (i == 0)
+            gnuplot_printf(handle, "%s %s using 1:2 title \"%s\" with %s \\", cmd, name, t, handle->pstyle);
+        else
+            gnuplot_printf(handle, ", '' using 1:%u title \"%s\" with %s \\", i + 2, t, handle->pstyle);
+    }
+    gnuplot_cmd(handle, "");
+
+    handle->nplots += l;
+}
+
+void gnuplot_plot_multi_xy_resampled(
+    gnuplot_ctrl* handle,
+    double** x,
+    double** y,
+    uint32_t* n,
+    uint32_t l,
+    const double* grid,
+    uint32_t m,
+    uint32_t method,
+    const char** title)
+{
+    char name[32];
+
+    if (handle == NULL || x == NULL || y == NULL || n == NULL || (l < 1))
+        return;
+    for (uint32_t i = 0; i < l; i++) {
+        if (x[i] == NULL || y[i] == NULL || (n[i] < 1))
+            return;
+    }
+    if (grid == NULL) {
+        grid = x[0];
+        m = n[0];
+    }
+    if (m < 1)
+        return;
+    uint32_t* cursor = (uint32_t*)calloc(l, sizeof(uint32_t));
+    if (cursor == NULL)
+        return;
+    const char* cmd = (handle->multiplot == 0 && handle->nplots > 0) ? "replot" : "plot";
+
+    // one row per grid point, a column per series
+    gnuplot_datablock(handle, name, sizeof(name));
+    for (uint32_t j = 0; j < m; j++) {
+        fprintf(handle->gnucmd, "%18e", grid[j]);
+        for (uint32_t i = 0; i < l; i++) {
+            fprintf(handle->gnucmd, " %18e", gnuplot_resample_at(x[i], y[i], n[i], &cursor[i], grid[j], method));
+        }
+        fputs("\n", handle->gnucmd);
+    }
+    gnuplot_cmd(handle, "EOD");
+    free(cursor);
+
+    gnuplot_plot_block(handle, cmd, name, l, title);
+}
+
+/*---------------------------------------------------------------------------
+                            Density rasterizer
+ ---------------------------------------------------------------------------*/
+
+typedef struct {
+    double** x;
+    double** y;
+    uint32_t* n;
+    uint32_t l;
+    uint32_t width;
+    uint32_t height;
+    uint32_t nthreads;
+    /** Slices the image is cut in to sum the counts */
+    uint32_t nmerge;
+    /** Bounds of each thread, then of all: xmin, xmax, ymin, ymax */
+    double bounds[GNUPLOT_MAX_THREADS][4];
+    double xmin;
+    double ymin;
+    double xscale;
+    double yscale;
+    /** Hit counts of each thread, counts[0] gets the sum */
+    uint32_t* counts[GNUPLOT_MAX_THREADS];
+} gnuplot_density;
+
+static void gnuplot_density_bounds(void* arg, uint32_t t)
+{
+    gnuplot_density* d = (gnuplot_density*)arg;
+    double* b = d->bounds[t];
+
+    b[0] = b[2] = INFINITY;
+    b[1] = b[3] = -INFINITY;
+    for (uint32_t i = t; i < d->l; i += d->nthreads) {
+        for (uint32_t j = 0; j < d->n[i]; j++) {
+            double x = d->x[i][j];
+            double y = d->y[i][j];
+            if (!isfinite(x) || !isfinite(y))
+                continue;
+            b[0] = (x < b[0]) ? x : b[0];
+            b[1] = (x > b[1]) ? x : b[1];
+            b[2] = (y < b[2]) ? y : b[2];
+            b[3] = (y > b[3]) ? y : b[3];
+        }
+    }
+}
+
+/*
+ * Draw the series of thread t in its own count buffer. A pixel is counted
+ * once per segment crossing it; the first pixel of a segment is skipped as
+ * it is the last one of the previous segment.
+ */
+static void gnuplot_density_draw(void* arg, uint32_t t)
+{
+    gnuplot_density* d = (gnuplot_density*)arg;
+    uint32_t* counts = d->counts[t];
+    const uint32_t w = d->width;
+
+    for (uint32_t i = t; i < d->l; i += d->nthreads) {
+        double px = 0.0;
+        double py = 0.0;
+        int first = 1;
+
+        for (uint32_t j = 0; j < d->n[i]; j++) {
+            double x = d->x[i][j];
+            double y = d->y[i][j];
+            if (!isfinite(x) || !isfinite(y)) {
+                first = 1;
+                continue;
+            }
+            x = (x - d->xmin) * d->xscale;
+            y = (y - d->ymin) * d->yscale;
+
+            if (first) {
+                counts[(uint32_t)(y + 0.5) * w + (uint32_t)(x + 0.5)]++;
+                first = 0;
+            } else {
+                double dx = x - px;
+                double dy = y - py;
+                double adx = fabs(dx);
+                double ady = fabs(dy);
+                uint32_t steps = (uint32_t)((adx > ady ? adx : ady) + 0.5);
+                if (steps > 0) {
+                    double sx = dx / steps;
+                    double sy = dy / steps;
+                    for (uint32_t s = 1; s <= steps; s++) {
+                        counts[(uint32_t)(py + sy * s + 0.5) * w + (uint32_t)(px + sx * s + 0.5)]++;
+                    }
+                }
+            }
+            px = x;
+            py = y;
+        }
+    }
+}
+
+static void gnuplot_density_merge(void* arg, uint32_t t)
+{
+    gnuplot_density* d = (gnuplot_density*)arg;
+    size_t size = (size_t)d->width * d->height;
+    size_t begin = size * t / d->nmerge;
+    size_t end = size * (t + 1) / d->nmerge;
+
+    for (uint32_t k = 1; k < d->nthreads; k++) {
+        const uint32_t* src = d->counts[k];
+        uint32_t* dst = d->counts[0];
+        for (size_t i = begin; i < end; i++) {
+            dst[i] += src[i];
+        }
+    }
+}
+
+/*
+ * Colormaps as a few stops on [0, 1], interpolated linearly.
+ */
+static void gnuplot_colormap(uint32_t cmap, double v, unsigned char* rgb)
+{
+    static const unsigned char gray[2][3] = { { 230, 230, 230 }, { 0, 0, 0 } };
+    static const unsigned char hot[4][3] = {
+        { 40, 0, 0 }, { 230, 0, 0 }, { 255, 210, 0 }, { 255, 255, 255 }
+    };
+    static const unsigned char viridis[5][3] = {
+        { 68, 1, 84 }, { 59, 82, 139 }, { 33, 145, 140 }, { 94, 201, 98 }, { 253, 231, 37 }
+    };
+    const unsigned char(*stops)[3];
+    uint32_t nstops;
+
+    switch (cmap) {
+    case GNUPLOT_CMAP_GRAY:
+        stops = gray;
+        nstops = 2;
+        break;
+    case GNUPLOT_CMAP_HOT:
+        stops = hot;
+        nstops = 4;
+        break;
+    default:
+        stops = viridis;
+        nstops = 5;
+        break;
+    }
+
+    double pos = v * (nstops - 1);
+    uint32_t k = (uint32_t)pos;
+    if (k >= nstops - 1)
+        k = nstops - 2;
+    double f = pos - k;
+    for (int c = 0; c < 3; c++) {
+        rgb[c] = (unsigned char)(stops[k][c] + (stops[k + 1][c] - stops[k][c]) * f + 0.5);
+    }
+}
+
+void gnuplot_plot_density(
+    gnuplot_ctrl* handle,
+    double** x,
+    double** y,
+    uint32_t* n,
+    uint32_t l,
+    uint32_t width,
+    uint32_t height,
+    uint32_t cmap,
+    uint32_t flags,
+    const char* title)
+{
+    gnuplot_density d;
+
+    if (handle == NULL || x == NULL || y == NULL || n == NULL || (l < 1) || width < 2 || height < 2)
+        return;
+    for (uint32_t i = 0; i < l; i++) {
+        if (x[i] == NULL || y[i] == NULL)
+            return;
+    }
+
+    memset(&d, 0, sizeof(d));
+    d.x = x;
+    d.y = y;
+    d.n = n;
+    d.l = l;
+    d.width = width;
+    d.height = height;
+
+    d.nthreads = gnuplot_nthreads(l, 0);
+    gnuplot_parallel(d.nthreads, gnuplot_density_bounds, &d);
+    double xmin = INFINITY, xmax = -INFINITY, ymin = INFINITY, ymax = -INFINITY;
+    for (uint32_t t = 0; t < d.nthreads; t++) {
+        xmin = (d.bounds[t][0] < xmin) ? d.bounds[t][0] : xmin;
+        xmax = (d.bounds[t][1] > xmax) ? d.bounds[t][1] : xmax;
+        ymin = (d.bounds[t][2] < ymin) ? d.bounds[t][2] : ymin;
+        ymax = (d.bounds[t][3] > ymax) ? d.bounds[t][3] : ymax;
+    }
+    if (xmin > xmax)
+        return;
+    if (xmax == xmin)
+        xmax = xmin + 1.0;
+    if (ymax == ymin)
+        ymax = ymin + 1.0;
+    d.xmin = xmin;
+    d.ymin = ymin;
+    d.xscale = (width - 1) / (xmax - xmin);
+    d.yscale = (height - 1) / (ymax - ymin);
+
+    size_t size = (size_t)width * height;
+    d.nthreads = gnuplot_nthreads(l, size * sizeof(uint32_t));
+    for (uint32_t t = 0; t < d.nthreads; t++) {
+        d.counts[t] = (uint32_t*)calloc(size, sizeof(uint32_t));
+        if (d.counts[t] == NULL) {
+            d.nthreads = (t > 0) ? t : 1;
+            break;
+        }
+    }
+    if (d.counts[0] == NULL)
+        return;
+    gnuplot_parallel(d.nthreads, gnuplot_density_draw, &d);
+    d.nmerge = gnuplot_nthreads(height, 0);
+    gnuplot_parallel(d.nmerge, gnuplot_density_merge, &d);
+    for (uint32_t t = 1; t < d.nthreads; t++) {
+        free(d.counts[t]);
+    }
+
+    uint32_t* counts = d.counts[0];
+    uint32_t max = 0;
+    for (size_t i = 0; i < size; i++) {
+        max = (counts[i] > max) ? counts[i] : max;
+    }
+    double norm = (flags & GNUPLOT_DENSITY_LOG) ? 1.0 / log1p((double)max) : 1.0 / max;
+
+    const char* cmd = (handle->multiplot == 0 && handle->nplots > 0) ? "replot" : "plot";
+    title = (title == NULL) ? "(none)" : title;
+
+    if (cmap == GNUPLOT_CMAP_PALETTE) {
+        // values on [0, 1] colored by the gnuplot palette, empty pixels undefined
+        gnuplot_cmd(handle, "%s '-' binary array=(%u,%u) dx=%.17g dy=%.17g origin=(%.17g,%.17g) "
+                            "format='%%float' with image title \"%s\"",
+            cmd, width, height, 1.0 / d.xscale, 1.0 / d.yscale, xmin, ymin, title);
+        for (size_t i = 0; i < size; i++) {
+            float v = NAN;
+            if (counts[i] > 0)
+                v = (float)(((flags & GNUPLOT_DENSITY_LOG) ? log1p((double)counts[i]) : counts[i]) * norm);
+            fwrite(&v, sizeof(v), 1, handle->gnucmd);
+        }
+    } else {
+        // empty pixels fully transparent so that the image can be overlaid
+        unsigned char lut[256][4];
+        for (uint32_t i = 0; i < 256; i++) {
+            gnuplot_colormap(cmap, i / 255.0, lut[i]);
+            lut[i][3] = 255;
+        }
+        gnuplot_cmd(handle, "%s '-' binary array=(%u,%u) dx=%.17g dy=%.17g origin=(%.17g,%.17g) "
+                            "format='%%uchar%%uchar%%uchar%%uchar' with rgbalpha title \"%s\"",
+            cmd, width, height, 1.0 / d.xscale, 1.0 / d.yscale, xmin, ymin, title);
+        for (size_t i = 0; i < size; i++) {
+            static const unsigned char empty[4] = { 0, 0, 0, 0 };
+            const unsigned char* px = empty;
+            if (counts[i] > 0) {
+                double v = ((flags & GNUPLOT_DENSITY_LOG) ? log1p((double)counts[i]) : counts[i]) * norm;
+                px = lut[(uint32_t)(v * 255.0 + 0.5)];
+            }
+            fwrite(px, 1, 4, handle->gnucmd);
+        }
+    }
+    fflush(handle->gnucmd);
+    free(counts);
+
+    handle->nplots++;
+}
+
+/*---------------------------------------------------------------------------
+                            Contour lines
+ ---------------------------------------------------------------------------*/
+
+/*
+ * Edges of a marching squares cell: 0 bottom, 1 right, 2 top, 3 left. Each
+ * case lists up to two segments as pairs of edges, -1 ending the list. The
+ * two saddle cases (5 and 10) are resolved in gnuplot_contour_band().
+ */
+static const int8_t gnuplot_contour_cases[16][4] = {
+    { -1, -1, -1, -1 }, { 3, 0, -1, -1 }, { 0, 1, -1, -1 }, { 3, 1, -1, -1 },
+    { 1, 2, -1, -1 }, { 3, 0, 1, 2 }, { 0, 2, -1, -1 }, { 3, 2, -1, -1 },
+    { 2, 3, -1, -1 }, { 0, 2, -1, -1 }, { 0, 1, 2, 3 }, { 1, 2, -1, -1 },
+    { 3, 1, -1, -1 }, { 0, 1, -1, -1 }, { 3, 0, -1, -1 }, { -1, -1, -1, -1 }
+};
+
+typedef struct {
+    const double* grid;
+    uint32_t rows;
+    uint32_t cols;
+    const double* levels;
+    uint32_t nlevels;
+    uint32_t nthreads;
+    /** Segments of each thread as x0, y0, x1, y1, level */
+    double* segs[GNUPLOT_MAX_THREADS];
+    size_t nsegs[GNUPLOT_MAX_THREADS];
+    size_t cap[GNUPLOT_MAX_THREADS];
+    int failed;
+} gnuplot_contour;
+
+/*
+ * Point where the level crosses an edge of the cell at (r, c), whose corner
+ * values are v[0] bottom left, v[1] bottom right, v[2] top right and v[3]
+ * top left.
+ */
+static void gnuplot_contour_point(const double* v, uint32_t r, uint32_t c, int edge, double level, double* p)
+{
+    static const int ends[4][2] = { { 0, 1 }, { 1, 2 }, { 3, 2 }, { 0, 3 } };
+    double a = v[ends[edge][0]];
+    double b = v[ends[edge][1]];
+    double t = (b != a) ? (level - a) / (b - a) : 0.5;
+
+    switch (edge) {
+    case 0:
+        p[0] = c + t;
+        p[1] = r;
+        break;
+    case 1:
+        p[0] = c + 1;
+        p[1] = r + t;
+        break;
+    case 2:
+        p[0] = c + t;
+        p[1] = r + 1;
+        break;
+    default:
+        p[0] = c;
+        p[1] = r + t;
+        break;
+    }
+}
+
+/*
+ * Cells of rows [rows * t / nthreads, rows * (t + 1) / nthreads), for all
+ * levels.
+ */
+static void gnuplot_contour_band(void* arg, uint32_t t)
+{
+    gnuplot_contour* d = (gnuplot_contour*)arg;
+    uint32_t cells = d->rows - 1;
+    uint32_t begin = (uint32_t)((uint64_t)cells * t / d->nthreads);
+    uint32_t end = (uint32_t)((uint64_t)cells * (t + 1) / d->nthreads);
+
+    for (uint32_t r = begin; r < end; r++) {
+        const double* lo = d->grid + (size_t)r * d->cols;
+        const double* hi = lo + d->cols;
+        for (uint32_t c = 0; c + 1 < d->cols; c++) {
+            double v[4] = { lo[c], lo[c + 1], hi[c + 1], hi[c] };
+            if (isnan(v[0]) || isnan(v[1]) || isnan(v[2]) || isnan(v[3]))
+                continue;
+            double vmin = fmin(fmin(v[0], v[1]), fmin(v[2], v[3]));
+            double vmax = fmax(fmax(v[0], v[1]), fmax(v[2], v[3]));
+
+            for (uint32_t l = 0; l < d->nlevels; l++) {
+                double level = d->levels[l];
+                if (level < vmin || level > vmax)
+                    continue;
+                int k = (v[0] >= level) | (v[1] >= level) << 1 | (v[2] >= level) << 2 | (v[3] >= level) << 3;
+                const int8_t* e = gnuplot_contour_cases[k];
+                int8_t saddle[4];
+                if (k == 5 || k == 10) {
+                    // the average of the corners decides which diagonal is connected
+                    int centre = (v[0] + v[1] + v[2] + v[3]) / 4.0 >= level;
+                    memcpy(saddle, gnuplot_contour_cases[(k == 5) == centre ? 10 : 5], sizeof(saddle));
+                    e = saddle;
+                }
+
+                for (int s = 0; s < 4 && e[s] >= 0; s += 2) {
+                    if (d->nsegs[t] == d->cap[t]) {
+                        size_t cap = (d->cap[t] > 0) ? d->cap[t] * 2 : 4096;
+                        double* segs = (double*)realloc(d->segs[t], cap * 5 * sizeof(double));
+                        if (segs == NULL) {
+                            d->failed = 1;
+                            return;
+                        }
+                        d->segs[t] = segs;
+                        d->cap[t] = cap;
+                    }
+                    double* seg = d->segs[t] + d->nsegs[t] * 5;
+                    gnuplot_contour_point(v, r, c, e[s], level, seg);
+                    gnuplot_contour_point(v, r, c, e[s + 1], level, seg + 2);
+                    seg[4] = level;
+                    d->nsegs[t]++;
+                }
+            }
+        }
+    }
+}
+
+void gnuplot_plot_contours(
+    gnuplot_ctrl* handle,
+    const double* grid,
+    uint32_t rows,
+    uint32_t cols,
+    const double* levels,
+    uint32_t nlevels,
+    const char* title)
+{
+    gnuplot_contour d;
+
+    if (handle == NULL || grid == NULL || levels == NULL || rows < 2 || cols < 2 || nlevels < 1)
+        return;
+
+    memset(&d, 0, sizeof(d));
+    d.grid = grid;
+    d.rows = rows;
+    d.cols = cols;
+    d.levels = levels;
+    d.nlevels = nlevels;
+    d.nthreads = gnuplot_nthreads(rows - 1, 0);
+    gnuplot_parallel(d.nthreads, gnuplot_contour_band, &d);
+
+    size_t n = 0;
+    for (uint32_t t = 0; t < d.nthreads; t++) {
+        n += d.nsegs[t];
+    }
+    if (d.failed) {
+        fprintf(stderr, "out of memory for %zu contour segments\n", n);
+    } else if (n > 0) {
+        const char* cmd = (handle->multiplot == 0 && handle->nplots > 0) ? "replot" : "plot";
+        title = (title == NULL) ? "(none)" : title;
+
+        gnuplot_cmd(handle, "%s '-' binary record=(%zu) format='%%float64%%float64%%float64%%float64%%float64' "
+                            "using 1:2:($3-$1):($4-$2):5 with vectors nohead lc palette title \"%s\"",
+            cmd, n, title);
+        for (uint32_t t = 0; t < d.nthreads; t++) {
+            fwrite(d.segs[t], 5 * sizeof(double), d.nsegs[t], handle->gnucmd);
+        }
+        fflush(handle->gnucmd);
+        handle->nplots++;
+    }
+
+    for (uint32_t t = 0; t < d.nthreads; t++) {
+        free(d.segs[t]);
+    }
+}
+
+/*---------------------------------------------------------------------------
+                            Scattered data gridding
+ ---------------------------------------------------------------------------*/
+
+// IDW search stops once a ring of hash cells brings the count past this
+#define GNUPLOT_IDW_NEIGHBOURS 8
+
+typedef struct {
+    const double* x;
+    const double* y;
+    const double* z;
+    uint32_t rows;
+    uint32_t cols;
+    uint32_t method;
+    double power;
+    double* grid;
+    const double* bounds;
+    uint32_t nthreads;
+    /** Points sorted by nearest node, those of node i at [start[i], start[i + 1]) */
+    uint32_t* start;
+    uint32_t* order;
+} gnuplot_gridding;
+
+static void gnuplot_grid_rows(void* arg, uint32_t t)
+{
+    gnuplot_gridding* d = (gnuplot_gridding*)arg;
+    uint32_t begin = (uint32_t)((uint64_t)d->rows * t / d->nthreads);
+    uint32_t end = (uint32_t)((uint64_t)d->rows * (t + 1) / d->nthreads);
+    double dx = (d->bounds[1] - d->bounds[0]) / (d->cols - 1);
+    double dy = (d->bounds[3] - d->bounds[2]) / (d->rows - 1);
+    uint32_t reach = (d->rows > d->cols) ? d->rows : d->cols;
+
+    for (uint32_t r = begin; r < end; r++) {
+        for (uint32_t c = 0; c < d->cols; c++) {
+            size_t node = (size_t)r * d->cols + c;
+
+            if (d->method == GNUPLOT_GRID_BIN) {
+                double sum = 0.0;
+                for (uint32_t i = d->start[node]; i < d->start[node + 1]; i++) {
+                    sum += d->z[d->order[i]];
+                }
+                uint32_t count = d->start[node + 1] - d->start[node];
+                d->grid[node] = (count > 0) ? sum / count : NAN;
+                continue;
+            }
+
+            // rings of cells around the node until enough points are found
+            double nx = d->bounds[0] + c * dx;
+            double ny = d->bounds[2] + r * dy;
+            double wsum = 0.0;
+            double zsum = 0.0;
+            uint32_t found = 0;
+            int exact = 0;
+            for (uint32_t k = 0; k <= reach && found < GNUPLOT_IDW_NEIGHBOURS && !exact; k++) {
+                int64_t r0 = (int64_t)r - k, r1 = (int64_t)r + k;
+                int64_t c0 = (int64_t)c - k, c1 = (int64_t)c + k;
+                for (int64_t rr = (r0 < 0 ? 0 : r0); rr <= r1 && rr < d->rows; rr++) {
+                    int ring_row = (rr == r0 || rr == r1);
+                    for (int64_t cc = (c0 < 0 ? 0 : c0); cc <= c1 && cc < d->cols; cc++) {
+                        // inside the ring was searched already
+                        if (!ring_row && cc != c0 && cc != c1)
+                            cc = c1;
+                        if (cc >= d->cols)
+                            break;
+                        size_t cell = (size_t)rr * d->cols + cc;
+                        for (uint32_t i = d->start[cell]; i < d->start[cell + 1]; i++) {
+                            uint32_t p = d->order[i];
+                            double d2 = (d->x[p] - nx) * (d->x[p] - nx) + (d->y[p] - ny) * (d->y[p] - ny);
+                            if (d2 == 0.0) {
+                                zsum = d->z[p];
+                                wsum = 1.0;
+                                exact = 1;
+                                break;
+                            }
+                            double w = pow(d2, -0.5 * d->power);
+                            wsum += w;
+                            zsum += w * d->z[p];
+                            found++;
+                        }
+                        if (exact)
+                            break;
+                    }
+                    if (exact)
+                        break;
+                }
+            }
+            d->grid[node] = (wsum > 0.0) ? zsum / wsum : NAN;
+        }
+    }
+}
+
+int gnuplot_grid_scattered(
+    const double* x,
+    const double* y,
+    const double* z,
+    uint32_t n,
+    uint32_t rows,
+    uint32_t cols,
+    uint32_t method,
+    double power,
+    double* grid,
+    double* bounds)
+{
+    gnuplot_gridding d;
+
+    if (x == NULL || y == NULL || z == NULL || grid == NULL || bounds == NULL
+        || n < 1 || rows < 2 || cols < 2)
+        return -1;
+
+    bounds[0] = bounds[2] = INFINITY;
+    bounds[1] = bounds[3] = -INFINITY;
+    for (uint32_t i = 0; i < n; i++) {
+        if (!isfinite(x[i]) || !isfinite(y[i]))
+            continue;
+        bounds[0] = (x[i] < bounds[0]) ? x[i] : bounds[0];
+        bounds[1] = (x[i] > bounds[1]) ? x[i] : bounds[1];
+        bounds[2] = (y[i] < bounds[2]) ? y[i] : bounds[2];
+        bounds[3] = (y[i] > bounds[3]) ? y[i] : bounds[3];
+    }
+    if (bounds[0] > bounds[1])
+        return -1;
+    if (bounds[1] == bounds[0])
+        bounds[1] = bounds[0] + 1.0;
+    if (bounds[3] == bounds[2])
+        bounds[3] = bounds[2] + 1.0;
+
+    size_t cells = (size_t)rows * cols;
+    memset(&d, 0, sizeof(d));
+    d.start = (uint32_t*)calloc(cells + 1, sizeof(uint32_t));
+    d.order = (uint32_t*)malloc(n * sizeof(uint32_t));
+    uint32_t* node = (uint32_t*)malloc(n * sizeof(uint32_t));
+    if (d.start == NULL || d.order == NULL || node == NULL) {
+        free(d.start);
+        free(d.order);
+        free(node);
+        return -1;
+    }
+
+    // counting sort of the points by nearest node, the node grid is the hash
+    double sx = (cols - 1) / (bounds[1] - bounds[0]);
+    double sy = (rows - 1) / (bounds[3] - bounds[2]);
+    for (uint32_t i = 0; i < n; i++) {
+        if (!isfinite(x[i]) || !isfinite(y[i])) {
+            node[i] = UINT32_MAX;
+            continue;
+        }
+        uint32_t c = (uint32_t)((x[i] - bounds[0]) * sx + 0.5);
+        uint32_t r = (uint32_t)((y[i] - bounds[2]) * sy + 0.5);
+        node[i] = r * cols + c;
+        d.start[node[i] + 1]++;
+    }
+    for (size_t i = 0; i < cells; i++) {
+        d.start[i + 1] += d.start[i];
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        if (node[i] != UINT32_MAX)
+            d.order[d.start[node[i]]++] = i;
+    }
+    // start[i] now holds the end of node i, shift it back
+    memmove(d.start + 1, d.start, cells * sizeof(uint32_t));
+    d.start[0] = 0;
+    free(node);
+
+    d.x = x;
+    d.y = y;
+    d.z = z;
+    d.rows = rows;
+    d.cols = cols;
+    d.method = method;
+    d.power = (power > 0.0) ? power : 2.0;
+    d.grid = grid;
+    d.bounds = bounds;
+    d.nthreads = gnuplot_nthreads(rows, 0);
+    gnuplot_parallel(d.nthreads, gnuplot_grid_rows, &d);
+
+    free(d.start);
+    free(d.order);
+    return 0;
+}
+
+void gnuplot_splot_grid(
+    gnuplot_ctrl* handle,
+    const double* grid,
+    uint32_t rows,
+    uint32_t cols,
+    const double* bounds,
+    const char* title)
+{
+    if (handle == NULL || grid == NULL || bounds == NULL || rows < 2 || cols < 2)
+        return;
+    const char* cmd = (handle->multiplot == 0 && handle->nplots > 0) ? "replot" : "splot";
+    title = (title == NULL) ? "(none)" : title;
+
+    gnuplot_cmd(handle, "%s '-' binary array=(%u,%u) dx=%.17g dy=%.17g origin=(%.17g,%.17g,0) "
+                        "format='%%float64' title \"%s\" with %s",
+        cmd, cols, rows, (bounds[1] - bounds[0]) / (cols - 1), (bounds[3] - bounds[2]) / (rows - 1),
+        bounds[0], bounds[2], title, handle->pstyle);
+    fwrite(grid, sizeof(double), (size_t)rows * cols, handle->gnucmd);
+    fflush(handle->gnucmd);
+
+    handle->nplots++;
+}
+
+/*---------------------------------------------------------------------------
+                            Fourier transforms
+ ---------------------------------------------------------------------------*/
+
+/*
+ * Complex FFT of a power of two size, iterative radix-2. Data is
+ * interleaved re, im. Inverse transforms are not scaled.
+ */
+static gnuplot_fft_plan* gnuplot_fft_plan_init(uint32_t n)
+{
+    gnuplot_fft_plan* plan;
+
+    if (n < 2 || (n & (n - 1)) != 0)
+        return NULL;
+    plan = (gnuplot_fft_plan*)calloc(1, sizeof(gnuplot_fft_plan));
+    if (plan == NULL)
+        return NULL;
+    plan->n = n;
+    plan->twiddle = (double*)malloc(n * sizeof(double));
+    plan->rev = (uint32_t*)malloc(n * sizeof(uint32_t));
+    if (plan->twiddle == NULL || plan->rev == NULL) {
+        gnuplot_fft_plan_free(plan);
+        return NULL;
+    }
+
+    for (uint32_t k = 0; k < n / 2; k++) {
+        plan->twiddle[2 * k] = cos(2.0 * M_PI * k / n);
+        plan->twiddle[2 * k + 1] = -sin(2.0 * M_PI * k / n);
+    }
+    uint32_t bits = 0;
+    while ((1u << bits) < n) {
+        bits++;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t r = 0;
+        for (uint32_t b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        plan->rev[i] = r;
+    }
+
+    return plan;
+}
+
+static void gnuplot_fft_plan_free(gnuplot_fft_plan* plan)
+{
+    if (plan == NULL)
+        return;
+    free(plan->twiddle);
+    free(plan->rev);
+    free(plan);
+}
+
+static void gnuplot_fft(const gnuplot_fft_plan* plan, double* data, int inverse)
+{
+    const uint32_t n = plan->n;
+    const double sign = inverse ? -1.0 : 1.0;
+
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t j = plan->rev[i];
+        if (i < j) {
+            double re = data[2 * i];
+            double im = data[2 * i + 1];
+            data[2 * i] = data[2 * j];
+            data[2 * i + 1] = data[2 * j + 1];
+            data[2 * j] = re;
+            data[2 * j + 1] = im;
+        }
+    }
+
+    for (uint32_t len = 2; len <= n; len <<= 1) {
+        uint32_t half = len >> 1;
+        uint32_t step = n / len;
+        for (uint32_t i = 0; i < n; i += len) {
+            for (uint32_t k = 0; k < half; k++) {
+                double wr = plan->twiddle[2 * k * step];
+                double wi = sign * plan->twiddle[2 * k * step + 1];
+                double* a = data + 2 * (i + k);
+                double* b = data + 2 * (i + k + half);
+                double tr = b[0] * wr - b[1] * wi;
+                double ti = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+}
+
+/*---------------------------------------------------------------------------
+                            Kernel density estimation
+ ---------------------------------------------------------------------------*/
+
+void gnuplot_plot_kde(
+    gnuplot_ctrl* handle,
+    const double* samples,
+    uint32_t n,
+    double bandwidth,
+    uint32_t points,
+    const char* title)
+{
+    if (handle == NULL || samples == NULL || (n < 1))
+        return;
+    if (points < 2)
+        points = 512;
+
+    double min = INFINITY;
+    double max = -INFINITY;
+    double mean = 0.0;
+    double m2 = 0.0;
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        double v = samples[i];
+        if (!isfinite(v))
+            continue;
+        min = (v < min) ? v : min;
+        max = (v > max) ? v : max;
+        // Welford, the variance of latencies can be large next to the mean
+        count++;
+        double delta = v - mean;
+        mean += delta / count;
+        m2 += delta * (v - mean);
+    }
+    if (count == 0)
+        return;
+    if (bandwidth <= 0.0) {
+        // Silverman's rule of thumb
+        double sd = (count > 1) ? sqrt(m2 / (count - 1)) : 0.0;
+        bandwidth = 1.06 * sd * pow(count, -0.2);
+        if (bandwidth <= 0.0)
+            bandwidth = (max > min) ? (max - min) / points : 1.0;
+    }
+
+    // the curve extends 3 bandwidths past the samples
+    double lo = min - 3.0 * bandwidth;
+    double delta = (max - min + 6.0 * bandwidth) / (points - 1);
+
+    // linear convolution of points values, zero-padded against wrap around
+    uint32_t size = 2;
+    while (size < 2 * points) {
+        size <<= 1;
+    }
+    gnuplot_fft_plan* plan = gnuplot_fft_plan_init(size);
+    double* bins = (double*)calloc(2 * (size_t)size, sizeof(double));
+    double* kernel = (double*)calloc(2 * (size_t)size, sizeof(double));
+    double* out = (double*)malloc(2 * (size_t)points * sizeof(double));
+    if (plan == NULL || bins == NULL || kernel == NULL || out == NULL) {
+        fprintf(stderr, "out of memory for a density of %u points\n", points);
+        gnuplot_fft_plan_free(plan);
+        free(bins);
+        free(kernel);
+        free(out);
+        return;
+    }
+
+    // linear binning, each sample split between its two nearest points
+    for (uint32_t i = 0; i < n; i++) {
+        if (!isfinite(samples[i]))
+            continue;
+        double pos = (samples[i] - lo) / delta;
+        uint32_t k = (uint32_t)pos;
+        if (k >= points - 1) {
+            bins[2 * (points - 1)] += 1.0;
+            continue;
+        }
+        double f = pos - k;
+        bins[2 * k] += 1.0 - f;
+        bins[2 * (k + 1)] += f;
+    }
+
+    // Gaussian sampled at both signs of the offsets, negative ones wrapped
+    double norm = 1.0 / (count * bandwidth * sqrt(2.0 * M_PI));
+    for (uint32_t k = 0; k < points; k++) {
+        double u = k * delta / bandwidth;
+        double v = norm * exp(-0.5 * u * u);
+        kernel[2 * k] = v;
+        if (k > 0)
+            kernel[2 * (size - k)] = v;
+    }
+
+    gnuplot_fft(plan, bins, 0);
+    gnuplot_fft(plan, kernel, 0);
+    for (uint32_t k = 0; k < size; k++) {
+        double re = bins[2 * k] * kernel[2 * k] - bins[2 * k + 1] * kernel[2 * k + 1];
+        double im = bins[2 * k] * kernel[2 * k + 1] + bins[2 * k + 1] * kernel[2 * k];
+        bins[2 * k] = re;
+        bins[2 * k + 1] = im;
+    }
+    gnuplot_fft(plan, bins, 1);
+
+    for (uint32_t k = 0; k < points; k++) {
+        out[2 * k] = lo + k * delta;
+        out[2 * k + 1] = fmax(bins[2 * k] / size, 0.0);
+    }
+
+    const char* cmd = (handle->multiplot == 0 && handle->nplots > 0) ? "replot" : "plot";
+    title = (title == NULL) ? "(none)" : title;
+
+    gnuplot_cmd(handle, "%s '-' binary record=(%u) format='%%float64%%float64' title \"%s\" with %s",
+        cmd, points, title, handle->pstyle);
+    fwrite(out, 2 * sizeof(double), points, handle->gnucmd);
+    fflush(handle->gnucmd);
+
+    gnuplot_fft_plan_free(plan);
+    free(bins);
+    free(kernel);
+    free(out);
+
+    handle->nplots++;
+}
+
+/*---------------------------------------------------------------------------
+                            Spectrum
+ ---------------------------------------------------------------------------*/
+
+// most points of a plotted spectrum, bins are peak-held down to this
+#define GNUPLOT_SPECTRUM_POINTS 2048
+
+static void gnuplot_spectrum_free(gnuplot_spectrum* spectrum)
+{
+    if (spectrum == NULL)
+        return;
+    gnuplot_fft_plan_free(spectrum->plan);
+    free(spectrum->window);
+    free(spectrum->split);
+    free(spectrum->data);
+    free(spectrum->out);
+    free(spectrum);
+}
+
+/*
+ * Spectrum state for blocks of n samples.
+ */
+static gnuplot_spectrum* gnuplot_spectrum_init(uint32_t n, uint32_t window)
+{
+    gnuplot_spectrum* spectrum;
+
+    uint32_t size = 4;
+    while (size < n) {
+        size <<= 1;
+    }
+    uint32_t half = size / 2;
+    uint32_t bins = half + 1;
+    uint32_t points = (bins > GNUPLOT_SPECTRUM_POINTS) ? GNUPLOT_SPECTRUM_POINTS : bins;
+
+    spectrum = (gnuplot_spectrum*)calloc(1, sizeof(gnuplot_spectrum));
+    if (spectrum == NULL)
+        return NULL;
+    spectrum->n = n;
+    spectrum->type = window;
+    spectrum->size = size;
+    spectrum->plan = gnuplot_fft_plan_init(half);
+    spectrum->window = (double*)malloc(n * sizeof(double));
+    spectrum->split = (double*)malloc(half * 2 * sizeof(double));
+    spectrum->data = (double*)malloc(size * sizeof(double));
+    spectrum->out = (double*)malloc(points * 2 * sizeof(double));
+    if (spectrum->plan == NULL || spectrum->window == NULL || spectrum->split == NULL
+        || spectrum->data == NULL || spectrum->out == NULL) {
+        gnuplot_spectrum_free(spectrum);
+        return NULL;
+    }
+
+    double sum = 0.0;
+    double m = (n > 1) ? n - 1 : 1;
+    for (uint32_t i = 0; i < n; i++) {
+        double w = 1.0;
+        switch (window) {
+        case GNUPLOT_WINDOW_HANN:
+            w = 0.5 - 0.5 * cos(2.0 * M_PI * i / m);
+            break;
+        case GNUPLOT_WINDOW_HAMMING:
+            w = 0.54 - 0.46 * cos(2.0 * M_PI * i / m);
+            break;
+        case GNUPLOT_WINDOW_BLACKMAN:
+            w = 0.42 - 0.5 * cos(2.0 * M_PI * i / m) + 0.08 * cos(4.0 * M_PI * i / m);
+            break;
+        default:
+            break;
+        }
+        spectrum->window[i] = w;
+        sum += w;
+    }
+    // one-sided amplitude of a sine matching the window's coherent gain
+    spectrum->scale = (sum > 0.0) ? 2.0 / sum : 1.0;
+
+    // W^k = exp(-2 i pi k / size) of the split into a real transform
+    for (uint32_t k = 0; k < half; k++) {
+        spectrum->split[2 * k] = cos(2.0 * M_PI * k / size);
+        spectrum->split[2 * k + 1] = -sin(2.0 * M_PI * k / size);
+    }
+
+    return spectrum;
+}
+
+/*
+ * Spectrum state of a handle, reused from the last call when n and the
+ * window are the same.
+ */
+static gnuplot_spectrum* gnuplot_spectrum_get(gnuplot_ctrl* handle, uint32_t n, uint32_t window)
+{
+    gnuplot_spectrum* spectrum = handle->spectrum;
+
+    if (spectrum != NULL && spectrum->n == n && spectrum->type == window)
+        return spectrum;
+    gnuplot_spectrum_free(spectrum);
+    handle->spectrum = gnuplot_spectrum_init(n, window);
+    return handle->spectrum;
+}
+
+/*
+ * Transform of n samples, read back with gnuplot_spectrum_db().
+ */
+static void gnuplot_spectrum_transform(gnuplot_spectrum* spectrum, const double* samples)
+{
+    // windowed samples, zero-padded, read as size / 2 complex values
+    double* data = spectrum->data;
+    const double* w = spectrum->window;
+    for (uint32_t i = 0; i < spectrum->n; i++) {
+        data[i] = samples[i] * w[i];
+    }
+    memset(data + spectrum->n, 0, (spectrum->size - spectrum->n) * sizeof(double));
+    gnuplot_fft(spectrum->plan, data, 0);
+}
+
+/*
+ * Magnitude in dB of bin k of the real transform, from the half size
+ * complex transform z of the even and odd samples.
+ */
+static inline double gnuplot_spectrum_db(const gnuplot_spectrum* spectrum, uint32_t k)
+{
+    const double* z = spectrum->data;
+    uint32_t half = spectrum->size / 2;
+    uint32_t a = (k == half) ? 0 : k;
+    uint32_t b = (k == 0) ? 0 : half - k;
+
+    // even part (z[k] + conj(z[half - k])) / 2, odd part -i (z[k] - conj(z[half - k])) / 2
+    double er = 0.5 * (z[2 * a] + z[2 * b]);
+    double ei = 0.5 * (z[2 * a + 1] - z[2 * b + 1]);
+    double or = 0.5 * (z[2 * a + 1] + z[2 * b + 1]);
+    double oi = -0.5 * (z[2 * a] - z[2 * b]);
+    double wr = (k == half) ? -1.0 : spectrum->split[2 * k];
+    double wi = (k == half) ? 0.0 : spectrum->split[2 * k + 1];
+    double re = er + wr * or - wi * oi;
+    double im = ei + wr * oi + wi * or;
+
+    double mag = sqrt(re * re + im * im) * spectrum->scale;
+    return (mag > 1e-15) ? 20.0 * log10(mag) : -300.0;
+}
+
+void gnuplot_plot_spectrum(
+    gnuplot_ctrl* handle,
+    const double* samples,
+    uint32_t n,
+    double fs,
+    uint32_t window,
+    const char* title)
+{
+    if (handle == NULL || samples == NULL || n < 2 || fs <= 0.0)
+        return;
+
+    gnuplot_spectrum* spectrum = gnuplot_spectrum_get(handle, n, window);
+    if (spectrum == NULL) {
+        fprintf(stderr, "out of memory for a spectrum of %u samples\n", n);
+        return;
+    }
+
+    gnuplot_spectrum_transform(spectrum, samples);
+
+    // peak hold over groups of bins
+    uint32_t bins = spectrum->size / 2 + 1;
+    uint32_t points = (bins > GNUPLOT_SPECTRUM_POINTS) ? GNUPLOT_SPECTRUM_POINTS : bins;
+    double df = fs / spectrum->size;
+    for (uint32_t p = 0; p < points; p++) {
+        uint32_t begin = (uint32_t)((uint64_t)bins * p / points);
+        uint32_t end = (uint32_t)((uint64_t)bins * (p + 1) / points);
+        uint32_t peak = begin;
+        double db = gnuplot_spectrum_db(spectrum, begin);
+        for (uint32_t k = begin + 1; k < end; k++) {
+            double v = gnuplot_spectrum_db(spectrum, k);
+            if (v > db) {
+                db = v;
+                peak = k;
+            }
+        }
+        spectrum->out[2 * p] = peak * df;
+        spectrum->out[2 * p + 1] = db;
+    }
+
+    const char* cmd = (handle->multiplot == 0 && handle->nplots > 0) ? "replot" : "plot";
+    title = (title == NULL) ? "(none)" : title;
+
+    gnuplot_cmd(handle, "%s '-' binary record=(%u) format='%%float64%%float64' title \"%s\" with %s",
+        cmd, points, title, handle->pstyle);
+    fwrite(spectrum->out, 2 * sizeof(double), points, handle->gnucmd);
+    fflush(handle->gnucmd);
+
+    handle->nplots++;
+}
+
+/*---------------------------------------------------------------------------
+                            OHLC bars
+ ---------------------------------------------------------------------------*/
+
+// ticks per thread below which aggregation is not split
+#define GNUPLOT_OHLC_CHUNK 65536
+
+typedef struct {
+    const double* t;
+    const double* price;
+    const double* volume;
+    uint64_t n;
+    double interval;
+    double origin;
+    uint32_t nthreads;
+    /** Bars of each chunk of ticks, and their bar numbers */
+    gnuplot_ohlc* bars[GNUPLOT_MAX_THREADS];
+    int64_t* index[GNUPLOT_MAX_THREADS];
+    uint32_t nbars[GNUPLOT_MAX_THREADS];
+    uint32_t cap[GNUPLOT_MAX_THREADS];
+    int failed;
+} gnuplot_ohlc_agg;
+
+static void gnuplot_ohlc_chunk(void* arg, uint32_t c)
+{
+    gnuplot_ohlc_agg* d = (gnuplot_ohlc_agg*)arg;
+    uint64_t begin = d->n * c / d->nthreads;
+    uint64_t end = d->n * (c + 1) / d->nthreads;
+    gnuplot_ohlc* bar = NULL;
+    int64_t last = INT64_MIN;
+
+    for (uint64_t i = begin; i < end; i++) {
+        double p = d->price[i];
+        if (!isfinite(p) || !isfinite(d->t[i]))
+            continue;
+        int64_t k = (int64_t)floor((d->t[i] - d->origin) / d->interval);
+
+        if (k != last) {
+            if (d->nbars[c] == d->cap[c]) {
+                uint32_t cap = (d->cap[c] > 0) ? d->cap[c] * 2 : 1024;
+                gnuplot_ohlc* bars = (gnuplot_ohlc*)realloc(d->bars[c], cap * sizeof(gnuplot_ohlc));
+                if (bars != NULL)
+                    d->bars[c] = bars;
+                int64_t* index = (int64_t*)realloc(d->index[c], cap * sizeof(int64_t));
+                if (index != NULL)
+                    d->index[c] = index;
+                if (bars == NULL || index == NULL) {
+                    d->failed = 1;
+                    return;
+                }
+                d->cap[c] = cap;
+            }
+            d->index[c][d->nbars[c]] = k;
+            bar = d->bars[c] + d->nbars[c]++;
+            bar->t = d->origin + k * d->interval;
+            bar->open = bar->high = bar->low = p;
+            bar->volume = 0.0;
+            last = k;
+        }
+        bar->high = (p > bar->high) ? p : bar->high;
+        bar->low = (p < bar->low) ? p : bar->low;
+        bar->close = p;
+        if (d->volume != NULL)
+            bar->volume += d->volume[i];
+    }
+}
+
+uint32_t gnuplot_ohlc_aggregate(
+    const double* t,
+    const double* price,
+    const double* volume,
+    uint64_t n,
+    double interval,
+    gnuplot_ohlc* bars,
+    uint32_t max)
+{
+    gnuplot_ohlc_agg d;
+    uint32_t count = 0;
+
+    if (t == NULL || price == NULL || bars == NULL || n < 1 || !(interval > 0.0))
+        return 0;
+
+    // bars start at multiples of the interval from the first usable tick
+    uint64_t first = 0;
+    while (first < n && !isfinite(t[first])) {
+        first++;
+    }
+    if (first == n)
+        return 0;
+
+    memset(&d, 0, sizeof(d));
+    d.t = t;
+    d.price = price;
+    d.volume = volume;
+    d.n = n;
+    d.interval = interval;
+    d.origin = floor(t[first] / interval) * interval;
+    d.nthreads = gnuplot_nthreads(n / GNUPLOT_OHLC_CHUNK + 1, 0);
+    gnuplot_parallel(d.nthreads, gnuplot_ohlc_chunk, &d);
+
+    if (d.failed) {
+        fprintf(stderr, "out of memory aggregating %llu ticks\n", (unsigned long long)n);
+    } else {
+        // a bar cut by a chunk boundary is the last of a chunk and the first of the next
+        int64_t last = INT64_MIN;
+        for (uint32_t c = 0; c < d.nthreads; c++) {
+            for (uint32_t i = 0; i < d.nbars[c]; i++) {
+                const gnuplot_ohlc* b = d.bars[c] + i;
+                if (d.index[c][i] == last) {
+                    gnuplot_ohlc* prev = bars + count - 1;
+                    prev->high = (b->high > prev->high) ? b->high : prev->high;
+                    prev->low = (b->low < prev->low) ? b->low : prev->low;
+                    prev->close = b->close;
+                    prev->volume += b->volume;
+                    continue;
+                }
+                if (count == max)
+                    break;
+                bars[count++] = *b;
+                last = d.index[c][i];
+            }
+        }
+    }
+
+    for (uint32_t c = 0; c < d.nthreads; c++) {
+        free(d.bars[c]);
+        free(d.index[c]);
+    }
+    return count;
+}
+
+void gnuplot_plot_ohlc(
+    gnuplot_ctrl* handle,
+    const gnuplot_ohlc* bars,
+    uint32_t n,
+    double interval,
+    const char* title)
+{
+    if (handle == NULL || bars == NULL || (n < 1))
+        return;
+    const char* cmd = (handle->multiplot == 0 && handle->nplots > 0) ? "replot" : "plot";
+    title = (title == NULL) ? "(none)" : title;
+
+    // boxes 80% of the bar interval wide, else of the closest two bars
+    double width = (interval > 0.0 && isfinite(interval)) ? interval : 0.0;
+    for (uint32_t i = 1; i < n && interval <= 0.0; i++) {
+        double gap = bars[i].t - bars[i - 1].t;
+        if (isfinite(gap) && gap > 0.0 && (width == 0.0 || gap < width))
+            width = gap;
+    }
+    width = (width > 0.0) ? 0.8 * width : 1.0;
+
+    gnuplot_cmd(handle, "%s '-' binary record=(%u) format='%%float64%%float64%%float64%%float64%%float64%%float64' "
+                        "using ($1+%.17g):2:4:3:5:(%.17g) with candlesticks title \"%s\", "
+                        "'-' binary record=(%u) format='%%float64%%float64' "
+                        "using ($1+%.17g):2:(%.17g) axes x1y2 with boxes fill solid 0.3 title \"volume\"",
+        cmd, n, width / 0.8 / 2.0, width, title, n, width / 0.8 / 2.0, width);
+    fwrite(bars, sizeof(gnuplot_ohlc), n, handle->gnucmd);
+    for (uint32_t i = 0; i < n; i++) {
+        double v[2] = { bars[i].t, bars[i].volume };
+        fwrite(v, sizeof(double), 2, handle->gnucmd);
+    }
+    fflush(handle->gnucmd);
+
+    handle->nplots++;
+}
+
+/*---------------------------------------------------------------------------
+                            Waterfall
+ ---------------------------------------------------------------------------*/
+
+gnuplot_waterfall* gnuplot_waterfall_init(
+    uint32_t fft_size,
+    uint32_t hop,
+    uint32_t rows,
+    double fs,
+    uint32_t window,
+    double max_fps)
+{
+    gnuplot_waterfall* wf;
+
+    if (fft_size < 2 || hop < 1 || rows < 2 || fs <= 0.0)
+        return NULL;
+    wf = (gnuplot_waterfall*)calloc(1, sizeof(gnuplot_waterfall));
+    if (wf == NULL)
+        return NULL;
+    wf->spectrum = gnuplot_spectrum_init(fft_size, window);
+    if (wf->spectrum == NULL) {
+        free(wf);
+        return NULL;
+    }
+    wf->hop = hop;
+    wf->rows = rows;
+    wf->bins = wf->spectrum->size / 2 + 1;
+    wf->fs = fs;
+    wf->interval = (max_fps > 0.0) ? (uint64_t)(1e9 / max_fps) : 0;
+    wf->pending = (double*)malloc(fft_size * sizeof(double));
+    wf->image = (float*)malloc((size_t)rows * wf->bins * sizeof(float));
+    if (wf->pending == NULL || wf->image == NULL) {
+        gnuplot_waterfall_close(wf);
+        return NULL;
+    }
+    // rows not computed yet are left undefined
+    for (size_t i = 0; i < (size_t)rows * wf->bins; i++) {
+        wf->image[i] = NAN;
+    }
+
+    return wf;
+}
+
+/*
+ * The pending block is full: its spectrum becomes the newest row, and the
+ * block moves forward by one hop.
+ */
+static void gnuplot_waterfall_row(gnuplot_waterfall* wf)
+{
+    uint32_t n = wf->spectrum->n;
+    float* row = wf->image + (size_t)wf->head * wf->bins;
+
+    gnuplot_spectrum_transform(wf->spectrum, wf->pending);
+    for (uint32_t k = 0; k < wf->bins; k++) {
+        row[k] = (float)gnuplot_spectrum_db(wf->spectrum, k);
+    }
+    wf->head = (wf->head + 1 < wf->rows) ? wf->head + 1 : 0;
+    wf->total++;
+
+    if (wf->hop < n) {
+        memmove(wf->pending, wf->pending + wf->hop, (n - wf->hop) * sizeof(double));
+        wf->fill = n - wf->hop;
+    } else {
+        wf->fill = 0;
+        wf->skip = wf->hop - n;
+    }
+}
+
+uint32_t gnuplot_waterfall_feed(gnuplot_waterfall* wf, const double* samples, uint32_t n)
+{
+    uint64_t total = wf->total;
+    uint32_t size = wf->spectrum->n;
+
+    while (n > 0) {
+        if (wf->skip > 0) {
+            uint32_t m = (wf->skip < n) ? wf->skip : n;
+            wf->skip -= m;
+            samples += m;
+            n -= m;
+            continue;
+        }
+        uint32_t m = (size - wf->fill < n) ? size - wf->fill : n;
+        memcpy(wf->pending + wf->fill, samples, m * sizeof(double));
+        wf->fill += m;
+        samples += m;
+        n -= m;
+        if (wf->fill == size)
+            gnuplot_waterfall_row(wf);
+    }
+
+    return (uint32_t)(wf->total - total);
+}
+
+uint32_t gnuplot_waterfall_feed_ring(gnuplot_waterfall* wf, gnuplot_ring* ring)
+{
+    uint64_t total = wf->total;
+    uint32_t size = wf->spectrum->n;
+
+    for (;;) {
+        uint32_t m;
+        if (wf->skip > 0) {
+            // no buffer, the skipped samples land in the pending block
+            uint32_t max = (wf->skip < size - wf->fill) ? wf->skip : size - wf->fill;
+            m = gnuplot_ring_read(ring, NULL, wf->pending + wf->fill, max);
+            wf->skip -= m;
+        } else {
+            // straight into the pending block
+            m = gnuplot_ring_read(ring, NULL, wf->pending + wf->fill, size - wf->fill);
+            wf->fill += m;
+            if (wf->fill == size)
+                gnuplot_waterfall_row(wf);
+        }
+        if (m == 0)
+            break;
+    }
+
+    return (uint32_t)(wf->total - total);
+}
+
+int gnuplot_waterfall_draw(gnuplot_ctrl* handle, gnuplot_waterfall* wf, const char* title)
+{
+    if (handle == NULL || wf == NULL || wf->total == 0)
+        return 0;
+    uint64_t now = gnuplot_now();
+    if (wf->drawn == wf->total || (wf->interval > 0 && now - wf->last < wf->interval))
+        return 0;
+    wf->last = now;
+    wf->drawn = wf->total;
+
+    const char* cmd = (handle->multiplot == 0 && handle->nplots > 0) ? "replot" : "plot";
+    title = (title == NULL) ? "(none)" : title;
+    double dt = wf->hop / wf->fs;
+
+    // time of the oldest row at the bottom, the newest on top
+    gnuplot_cmd(handle, "%s '-' binary array=(%u,%u) dx=%.17g dy=%.17g origin=(0,%.17g) "
+                        "format='%%float' with image title \"%s\"",
+        cmd, wf->bins, wf->rows, wf->fs / wf->spectrum->size, dt,
+        ((double)wf->total - wf->rows) * dt, title);
+    fwrite(wf->image + (size_t)wf->head * wf->bins, sizeof(float),
+        (size_t)(wf->rows - wf->head) * wf->bins, handle->gnucmd);
+    fwrite(wf->image, sizeof(float), (size_t)wf->head * wf->bins, handle->gnucmd);
+    fflush(handle->gnucmd);
+
+    handle->nplots++;
+    return 1;
+}
+
+void gnuplot_waterfall_close(gnuplot_waterfall* wf)
+{
+    if (wf == NULL)
+        return;
+    gnuplot_spectrum_free(wf->spectrum);
+    free(wf->pending);
+    free(wf->image);
+    free(wf);
+}
+
+/*---------------------------------------------------------------------------
+                            Frame export
+ ---------------------------------------------------------------------------*/
+
+#ifndef _WIN32
+typedef struct {
+    gnuplot_ctrl** sessions;
+    uint32_t nframes;
+    const char* terminal;
+    const char* pattern;
+    const char* dir;
+    gnuplot_frame_fn gen;
+    gnuplot_sink_fn sink;
+    void* user;
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /** Next frame to render, next frame to deliver */
+    uint32_t next;
+    uint32_t delivered;
+    /** Rendered frames waiting for delivery, frame f in slot f % window */
+    uint32_t window;
+    void** data;
+    size_t* size;
+    uint8_t* ready;
+    /** Set on the first failure, stops every worker */
+    int failed;
+    /** Workers with a session in an unknown state */
+    uint8_t* broken;
+} gnuplot_export;
+
+/*
+ * Reads a rendered frame back whole.
+ */
+static void* gnuplot_export_read(const char* path, size_t* size)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    char* data = (char*)malloc(st.st_size > 0 ? (size_t)st.st_size : 1);
+    size_t used = 0;
+    while (data != NULL && used < (size_t)st.st_size) {
+        ssize_t r = read(fd, data + used, (size_t)st.st_size - used);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        used += (size_t)r;
+    }
+    close(fd);
+    *size = used;
+    return data;
+}
+
+static void gnuplot_export_worker(gnuplot_export* e, uint32_t w)
+{
+    gnuplot_ctrl* handle = e->sessions[w];
+    char path[PATH_MAX];
+
+    gnuplot_cmd(handle, "set terminal %s", e->terminal);
+    if (e->sink != NULL)
+        snprintf(path, sizeof(path), "%s/gnuplot_i-%d-%u", e->dir, (int)getpid(), w);
+
+    for (;;) {
+        pthread_mutex_lock(&e->lock);
+        // with a sink, stay within the window of frames not delivered yet
+        while (!e->failed && e->sink != NULL && e->next < e->nframes
+            && e->next >= e->delivered + e->window) {
+            pthread_cond_wait(&e->cond, &e->lock);
+        }
+        uint32_t frame = e->next;
+        int stop = e->failed || frame >= e->nframes;
+        if (!stop)
+            e->next++;
+        pthread_mutex_unlock(&e->lock);
+        if (stop)
+            break;
+
+        if (e->sink == NULL)
+            snprintf(path, sizeof(path), e->pattern, frame);
+        gnuplot_cmd(handle, "set output \"%s\"", path);
+        gnuplot_resetplot(handle);
+        e->gen(handle, frame, e->user);
+        // the file is complete once gnuplot has closed it
+        gnuplot_cmd(handle, "unset output");
+        int ok = gnuplot_sync(handle, GNUPLOT_FRAME_TIMEOUT_MS) == 0;
+
+        void* data = NULL;
+        size_t size = 0;
+        if (ok && e->sink != NULL) {
+            data = gnuplot_export_read(path, &size);
+            ok = data != NULL;
+        }
+
+        pthread_mutex_lock(&e->lock);
+        if (!ok) {
+            if (!e->failed)
+                fprintf(stderr, "frame %u of the export failed\n", frame);
+            e->failed = 1;
+            e->broken[w] = 1;
+        } else if (e->sink != NULL) {
+            e->data[frame % e->window] = data;
+            e->size[frame % e->window] = size;
+            e->ready[frame % e->window] = 1;
+        }
+        pthread_cond_broadcast(&e->cond);
+        pthread_mutex_unlock(&e->lock);
+        if (!ok)
+            break;
+    }
+
+    if (e->sink != NULL)
+        unlink(path);
+}
+
+typedef struct {
+    gnuplot_export* e;
+    uint32_t w;
+} gnuplot_export_arg;
+
+static void* gnuplot_export_thread(void* p)
+{
+    gnuplot_export_arg* arg = (gnuplot_export_arg*)p;
+
+    gnuplot_sched_thread();
+    gnuplot_export_worker(arg->e, arg->w);
+    return NULL;
+}
+
+/*
+ * Frames are handed to the sink in order, on the calling thread.
+ */
+static void gnuplot_export_deliver(gnuplot_export* e)
+{
+    pthread_mutex_lock(&e->lock);
+    while (e->delivered < e->nframes) {
+        uint32_t slot = e->delivered % e->window;
+        while (!e->failed && !e->ready[slot]) {
+            pthread_cond_wait(&e->cond, &e->lock);
+        }
+        if (e->failed)
+            break;
+        void* data = e->data[slot];
+        size_t size = e->size[slot];
+        e->ready[slot] = 0;
+        e->data[slot] = NULL;
+        pthread_mutex_unlock(&e->lock);
+
+        int ret = e->sink(e->delivered, data, size, e->user);
+        free(data);
+
+        pthread_mutex_lock(&e->lock);
+        if (ret != 0)
+            e->failed = 1;
+        e->delivered++;
+        pthread_cond_broadcast(&e->cond);
+    }
+    pthread_mutex_unlock(&e->lock);
+}
+#endif // #ifndef _WIN32
+
+int gnuplot_export_frames(
+    gnuplot_pool* pool,
+    uint32_t nworkers,
+    uint32_t nframes,
+    const char* terminal,
+    const char* pattern,
+    gnuplot_frame_fn gen,
+    gnuplot_sink_fn sink,
+    void* user)
+{
+#ifdef _WIN32
+    (void)pool;
+    (void)nworkers;
+    (void)nframes;
+    (void)terminal;
+    (void)pattern;
+    (void)gen;
+    (void)sink;
+    (void)user;
+    return -1;
+#else
+    gnuplot_export e;
+    pthread_t threads[GNUPLOT_MAX_THREADS];
+    gnuplot_export_arg args[GNUPLOT_MAX_THREADS];
+    int started[GNUPLOT_MAX_THREADS];
+
+    if (terminal == NULL || gen == NULL || (pattern == NULL) == (sink == NULL))
+        return -1;
+    if (nframes == 0)
+        return 0;
+    if (nworkers == 0)
+        nworkers = gnuplot_nthreads(nframes, 0);
+    if (nworkers > nframes)
+        nworkers = nframes;
+    if (nworkers > GNUPLOT_MAX_THREADS)
+        nworkers = GNUPLOT_MAX_THREADS;
+
+    memset(&e, 0, sizeof(e));
+    gnuplot_pool* own = NULL;
+    if (pool == NULL) {
+        own = gnuplot_pool_init(nworkers);
+        if (own == NULL)
+            return -1;
+        pool = own;
+    }
+    e.sessions = (gnuplot_ctrl**)calloc(nworkers, sizeof(gnuplot_ctrl*));
+    e.broken = (uint8_t*)calloc(nworkers, 1);
+    e.window = 2 * nworkers;
+    e.data = (void**)calloc(e.window, sizeof(void*));
+    e.size = (size_t*)calloc(e.window, sizeof(size_t));
+    e.ready = (uint8_t*)calloc(e.window, 1);
+    uint32_t nsessions = 0;
+    if (e.sessions != NULL && e.broken != NULL && e.data != NULL && e.size != NULL && e.ready != NULL) {
+        while (nsessions < nworkers) {
+            e.sessions[nsessions] = gnuplot_pool_acquire(pool);
+            if (e.sessions[nsessions] == NULL)
+                break;
+            nsessions++;
+        }
+    }
+
+    int ret = -1;
+    if (nsessions > 0) {
+        e.nframes = nframes;
+        e.terminal = terminal;
+        e.pattern = pattern;
+        e.dir = (access("/dev/shm", W_OK) == 0) ? "/dev/shm" : P_tmpdir;
+        e.gen = gen;
+        e.sink = sink;
+        e.user = user;
+        pthread_mutex_init(&e.lock, NULL);
+        pthread_cond_init(&e.cond, NULL);
+
+        // gnuplot renders in the sessions' processes, a thread feeds each of them
+        uint32_t running = 0;
+        for (uint32_t w = 0; w < nsessions; w++) {
+            args[w].e = &e;
+            args[w].w = w;
+            started[w] = pthread_create(&threads[w], NULL, gnuplot_export_thread, &args[w]) == 0;
+            running += started[w];
+        }
+        if (running == 0) {
+            fprintf(stderr, "cannot start the export threads\n");
+            e.failed = 1;
+        } else if (sink != NULL)
+            gnuplot_export_deliver(&e);
+        for (uint32_t w = 0; w < nsessions; w++) {
+            if (started[w])
+                pthread_join(threads[w], NULL);
+        }
+
+        ret = e.failed ? -1 : 0;
+        pthread_cond_destroy(&e.cond);
+        pthread_mutex_destroy(&e.lock);
+    }
+
+    for (uint32_t w = 0; w < nsessions; w++) {
+        if (e.broken[w])
+            gnuplot_pool_discard(pool, e.sessions[w]);
+        else
+            gnuplot_pool_release(pool, e.sessions[w]);
+    }
+    for (uint32_t i = 0; e.data != NULL && i < e.window; i++) {
+        free(e.data[i]);
+    }
+    free(e.sessions);
+    free(e.broken);
+    free(e.data);
+    free(e.size);
+    free(e.ready);
+    if (own != NULL)
+        gnuplot_pool_close(own);
+    return ret;
+#endif // #ifdef _WIN32
+}
+
+/*---------------------------------------------------------------------------
+                            Session snapshots
+ ---------------------------------------------------------------------------*/
+
+#ifndef _WIN32
+/*
+ * Appends the plot command of a "save" file to a snapshot. Plots of inline
+ * data cannot be replayed, their data is gone, so they are left out, and
+ * the whole line commented out if nothing else remains. Returns the number
+ * of plots kept, -1 if the snapshot cannot grow.
+ */
+static int gnuplot_snapshot_plot(gnuplot_template* tpl, const char* line, size_t n)
+{
+    const char* end = line + n;
+    const char* p = line;
+    // each separator may grow to ", "
+    char* kept = (char*)malloc(2 * n + 1);
+    size_t len = 0;
+    int nkept = 0;
+    int dropped = 0;
+
+    if (kept == NULL)
+        return -1;
+
+    // the command word and the ranges apply to every plot
+    while (p < end && *p != ' ' && *p != '\t') {
+        p++;
+    }
+    for (;;) {
+        while (p < end && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        if (p == end || *p != '[')
+            break;
+        while (p < end && *p != ']') {
+            p++;
+        }
+        p += (p < end);
+    }
+    memcpy(kept, line, (size_t)(p - line));
+    len = (size_t)(p - line);
+
+    // plots are split at the commas outside of strings and brackets
+    while (p < end) {
+        const char* q = p;
+        char quote = 0;
+        int depth = 0;
+        int inline_data = 0;
+        for (; q < end && (quote != 0 || depth > 0 || *q != ','); q++) {
+            if (quote != 0) {
+                quote = (*q == quote) ? 0 : quote;
+                continue;
+            }
+            inline_data |= (q + 3 <= end && q[0] == '\'' && q[1] == '-' && q[2] == '\'');
+            if (*q == '"' || *q == '\'')
+                quote = *q;
+            else if (*q == '(' || *q == '[' || *q == '{')
+                depth++;
+            else if ((*q == ')' || *q == ']' || *q == '}') && depth > 0)
+                depth--;
+        }
+        if (inline_data) {
+            dropped = 1;
+        } else {
+            while (p < q && (*p == ' ' || *p == '\t')) {
+                p++;
+            }
+            if (nkept++ > 0) {
+                memcpy(kept + len, ", ", 2);
+                len += 2;
+            }
+            memcpy(kept + len, p, (size_t)(q - p));
+            len += (size_t)(q - p);
+        }
+        p = q + 1;
+    }
+
+    int ret;
+    if (!dropped)
+        ret = gnuplot_template_cmd(tpl, "%.*s", (int)n, line);
+    else if (nkept == 0)
+        ret = gnuplot_template_cmd(tpl, "# %.*s", (int)n, line);
+    else
+        ret = gnuplot_template_cmd(tpl, "%.*s", (int)len, kept);
+    free(kept);
+    return (ret != 0) ? -1 : nkept;
+}
+
+/*
+ * Appends the text of a "save" file to a snapshot. Returns the number of
+ * plots kept of the last plot command, 0 if there is none, -1 if the
+ * snapshot cannot grow.
+ */
+static int gnuplot_snapshot_append(gnuplot_template* tpl, char* text, size_t len)
+{
+    char* line = text;
+    int nplots = 0;
+
+    while (line < text + len) {
+        char* end = (char*)memchr(line, '\n', (size_t)(text + len - line));
+        size_t n = (end != NULL) ? (size_t)(end - line) : (size_t)(text + len - line);
+        const char* p = line;
+        while (p < line + n && (*p == ' ' || *p == '\t')) {
+            p++;
+        }
+        int plot = (strncmp(p, "plot", 4) == 0 || strncmp(p, "splot", 5) == 0 || strncmp(p, "replot", 6) == 0);
+        if (plot) {
+            nplots = gnuplot_snapshot_plot(tpl, p, (size_t)(line + n - p));
+            if (nplots < 0)
+                return -1;
+        } else if (gnuplot_template_cmd(tpl, "%.*s", (int)n, line) != 0) {
+            return -1;
+        }
+        line += n + 1;
+    }
+
+    return nplots;
+}
+#endif // #ifndef _WIN32
+
+gnuplot_session* gnuplot_snapshot(gnuplot_ctrl* handle)
+{
+#ifdef _WIN32
+    (void)handle;
+    return NULL;
+#else
+    char blocks[64];
+    char settings[64];
+    gnuplot_session* session;
+
+    if (handle == NULL)
+        return NULL;
+    int fd = gnuplot_tmp_file(blocks, sizeof(blocks));
+    if (fd < 0)
+        return NULL;
+    close(fd);
+    fd = gnuplot_tmp_file(settings, sizeof(settings));
+    if (fd < 0) {
+        unlink(blocks);
+        return NULL;
+    }
+    close(fd);
+
+    // gnuplot keeps datablocks as their lines, printed back as they came
+    gnuplot_cmd(handle, "set print \"%s\"", blocks);
+    for (uint32_t i = 0; i < handle->nblocks; i++) {
+        gnuplot_cmd(handle, "print \"$gpi_%u << EOD\"", i);
+        gnuplot_cmd(handle, "print $gpi_%u", i);
+        gnuplot_cmd(handle, "print \"EOD\"");
+    }
+    gnuplot_cmd(handle, "set print");
+    gnuplot_cmd(handle, "save \"%s\"", settings);
+
+    session = (gnuplot_session*)calloc(1, sizeof(gnuplot_session));
+    int ok = session != NULL && gnuplot_sync(handle, GNUPLOT_SNAPSHOT_TIMEOUT_MS) == 0;
+    if (ok)
+        session->tpl = gnuplot_template_init();
+    ok = ok && session->tpl != NULL;
+
+    // datablocks first, the saved plot command reads them
+    const char* paths[2] = { blocks, settings };
+    int nplots = 0;
+    for (int i = 0; i < 2; i++) {
+        size_t len = 0;
+        char* text = ok ? (char*)gnuplot_export_read(paths[i], &len) : NULL;
+        // there may be no datablocks, but a save is never empty
+        ok = ok && text != NULL && (i == 0 || len > 0);
+        nplots = ok ? gnuplot_snapshot_append(session->tpl, text, len) : -1;
+        ok = ok && nplots >= 0;
+        free(text);
+        unlink(paths[i]);
+    }
+    ok = ok && gnuplot_template_write(session->tpl) == 0;
+
+    if (!ok) {
+        fprintf(stderr, "cannot take a snapshot of the gnuplot session\n");
+        gnuplot_session_close(session);
+        return NULL;
+    }
+    memcpy(session->pstyle, handle->pstyle, sizeof(session->pstyle));
+    // what was left of the saved plot command is what a clone replots
+    session->nplots = (handle->nplots > 0) ? (uint32_t)nplots : 0;
+    session->nblocks = handle->nblocks;
+    session->datablock = handle->datablock;
+    return session;
+#endif // #ifdef _WIN32
+}
+
+gnuplot_ctrl* gnuplot_clone(const gnuplot_session* session, gnuplot_pool* pool)
+{
+    gnuplot_ctrl* handle;
+
+    if (session == NULL)
+        return NULL;
+    handle = (pool != NULL) ? gnuplot_pool_acquire(pool) : gnuplot_init();
+    if (handle == NULL)
+        return NULL;
+
+    gnuplot_cmd(handle, "load \"%s\"", session->tpl->path);
+    memcpy(handle->pstyle, session->pstyle, sizeof(handle->pstyle));
+    handle->nplots = session->nplots;
+    handle->nblocks = session->nblocks;
+    handle->datablock = session->datablock;
+    return handle;
+}
+
+void gnuplot_session_close(gnuplot_session* session)
+{
+    if (session == NULL)
+        return;
+    gnuplot_template_close(session->tpl);
+    free(session);
+}
+
+/*---------------------------------------------------------------------------
+                            Out-of-core files
+ ---------------------------------------------------------------------------*/
+
+// bytes of a file read at once by each thread
+#define GNUPLOT_FILE_CHUNK ((size_t)1 << 22)
+
+typedef struct {
+    /** Records of the smallest and largest y, UINT64_MAX if none */
+    uint64_t lo;
+    uint64_t hi;
+    double lo_x, lo_y;
+    double hi_x, hi_y;
+    /** Sums of the valid records and their number, for LTTB */
+    double sum_x, sum_y;
+    uint64_t count;
+} gnuplot_file_bucket;
+
+typedef struct {
+    int fd;
+    /** The whole file when mapped, NULL when read with pread() */
+    const char* map;
+    size_t page;
+    /** Doubles per record, and number of records */
+    uint32_t cols;
+    uint64_t n;
+    uint32_t reducer;
+    /** LTTB: 0 sums the buckets, 1 picks their points */
+    uint32_t pass;
+    /** Buckets cover span records from the record first */
+    gnuplot_file_bucket* buckets;
+    uint32_t nbuckets;
+    uint64_t first;
+    uint64_t span;
+    /** First and last points of the file */
+    double ax, ay, zx, zy;
+    uint32_t nthreads;
+    int failed;
+} gnuplot_file_scan;
+
+static uint64_t gnuplot_file_bucket_start(const gnuplot_file_scan* s, uint64_t b)
+{
+    // span * b / nbuckets, without overflowing on large files
+    uint64_t q = s->span / s->nbuckets;
+    uint64_t r = s->span % s->nbuckets;
+    return s->first + q * b + r * b / s->nbuckets;
+}
+
+/*
+ * Returns count records from the record first, in buf when the file is not
+ * mapped. NULL if the file cannot be read.
+ */
+static const double* gnuplot_file_window(gnuplot_file_scan* s, double* buf, uint64_t first, uint64_t count)
+{
+    size_t rec = s->cols * sizeof(double);
+    off_t off = (off_t)(first * rec);
+    size_t len = (size_t)count * rec;
+
+    if (s->map != NULL)
+        return (const double*)(s->map + off);
+
+    // the kernel reads the next window while this one is reduced
+    if ((first + count) < s->n)
+        posix_fadvise(s->fd, off + (off_t)len, (off_t)len, POSIX_FADV_WILLNEED);
+    for (size_t done = 0; done < len;) {
+        ssize_t r = pread(s->fd, (char*)buf + done, len - done, off + (off_t)done);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            return NULL;
+        done += (size_t)r;
+    }
+    return buf;
+}
+
+/*
+ * Drops the pages of a reduced window, so that memory does not grow with the
+ * size of the file.
+ */
+static void gnuplot_file_release(gnuplot_file_scan* s, uint64_t first, uint64_t count)
+{
+    size_t rec = s->cols * sizeof(double);
+    size_t begin = (size_t)(first * rec) / s->page * s->page;
+    size_t end = (size_t)((first + count) * rec) / s->page * s->page;
+
+    if (end <= begin)
+        return;
+    if (s->map != NULL)
+        madvise((void*)(s->map + begin), end - begin, MADV_DONTNEED);
+    else
+        posix_fadvise(s->fd, (off_t)begin, (off_t)(end - begin), POSIX_FADV_DONTNEED);
+}
+
+/*
+ * Point the next bucket leans to in LTTB, its average, or the last point of
+ * the file after the last bucket.
+ */
+static void gnuplot_file_lttb_next(const gnuplot_file_scan* s, uint64_t b, double* x, double* y)
+{
+    if (b + 1 < s->nbuckets && s->buckets[b + 1].count > 0) {
+        *x = s->buckets[b + 1].sum_x / (double)s->buckets[b + 1].count;
+        *y = s->buckets[b + 1].sum_y / (double)s->buckets[b + 1].count;
+    } else {
+        *x = s->zx;
+        *y = s->zy;
+    }
+}
+
+/*
+ * Reduces the buckets of thread t. In LTTB, the point picked in a bucket
+ * depends on the one picked before, so the first bucket of each thread leans
+ * on the average of the previous bucket instead.
+ */
+static void gnuplot_file_chunk(void* arg, uint32_t t)
+{
+    gnuplot_file_scan* s = (gnuplot_file_scan*)arg;
+    uint64_t b = (uint64_t)s->nbuckets * t / s->nthreads;
+    uint64_t last = (uint64_t)s->nbuckets * (t + 1) / s->nthreads;
+    uint64_t per = GNUPLOT_FILE_CHUNK / (s->cols * sizeof(double));
+    int lttb = s->reducer == GNUPLOT_REDUCE_LTTB;
+    double* buf = NULL;
+
+    if (b == last)
+        return;
+    if (s->map == NULL) {
+        buf = (double*)malloc(GNUPLOT_FILE_CHUNK);
+        if (buf == NULL) {
+            s->failed = 1;
+            return;
+        }
+    }
+
+    double ax = s->ax;
+    double ay = s->ay;
+    double cx = 0.0;
+    double cy = 0.0;
+    double best = -1.0;
+    if (lttb && s->pass == 1) {
+        if (b > 0 && s->buckets[b - 1].count > 0) {
+            ax = s->buckets[b - 1].sum_x / (double)s->buckets[b - 1].count;
+            ay = s->buckets[b - 1].sum_y / (double)s->buckets[b - 1].count;
+        }
+        gnuplot_file_lttb_next(s, b, &cx, &cy);
+    }
+
+    uint64_t end = gnuplot_file_bucket_start(s, last);
+    uint64_t next = gnuplot_file_bucket_start(s, b + 1);
+    for (uint64_t r = gnuplot_file_bucket_start(s, b); r < end;) {
+        uint64_t count = (end - r < per) ? end - r : per;
+        const double* v = gnuplot_file_window(s, buf, r, count);
+        if (v == NULL) {
+            s->failed = 1;
+            break;
+        }
+
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t k = r + i;
+            while (k >= next) {
+                gnuplot_file_bucket* done = s->buckets + b;
+                if (lttb && s->pass == 1 && done->lo != UINT64_MAX) {
+                    ax = done->lo_x;
+                    ay = done->lo_y;
+                }
+                b++;
+                next = gnuplot_file_bucket_start(s, b + 1);
+                if (lttb && s->pass == 1)
+                    gnuplot_file_lttb_next(s, b, &cx, &cy);
+                best = -1.0;
+            }
+
+            double x = (s->cols == 2) ? v[2 * i] : (double)k;
+            double y = v[i * s->cols + s->cols - 1];
+            if (isnan(x) || isnan(y))
+                continue;
+            gnuplot_file_bucket* bucket = s->buckets + b;
+            if (!lttb) {
+                if (bucket->lo == UINT64_MAX || y < bucket->lo_y) {
+                    bucket->lo = k;
+                    bucket->lo_x = x;
+                    bucket->lo_y = y;
+                }
+                if (bucket->hi == UINT64_MAX || y > bucket->hi_y) {
+                    bucket->hi = k;
+                    bucket->hi_x = x;
+                    bucket->hi_y = y;
+                }
+            } else if (s->pass == 0) {
+                bucket->sum_x += x;
+                bucket->sum_y += y;
+                bucket->count++;
+            } else {
+                // twice the area of the triangle with the last pick and the next average
+                double area = fabs((ax - cx) * (y - ay) - (ax - x) * (cy - ay));
+                if (area > best) {
+                    best = area;
+                    bucket->lo = k;
+                    bucket->lo_x = x;
+                    bucket->lo_y = y;
+                }
+            }
+        }
+
+        gnuplot_file_release(s, r, count);
+        r += count;
+    }
+
+    free(buf);
+}
+
+int gnuplot_plot_file(
+    gnuplot_ctrl* handle,
+    const char* path,
+    uint32_t layout,
+    uint32_t reducer,
+    uint32_t target,
+    uint32_t flags,
+    const char* title)
+{
+#ifdef _WIN32
+    (void)handle;
+    (void)path;
+    (void)layout;
+    (void)reducer;
+    (void)target;
+    (void)flags;
+    (void)title;
+    fprintf(stderr, "gnuplot_plot_file is not supported on this platform\n");
+    return -1;
+#else
+    gnuplot_file_scan s;
+    struct stat st;
+
+    if (handle == NULL || path == NULL)
+        return -1;
+    const char* cmd = (handle->multiplot == 0 && handle->nplots > 0) ? "replot" : "plot";
+    title = (title == NULL) ? "(none)" : title;
+
+    memset(&s, 0, sizeof(s));
+    s.cols = (layout == GNUPLOT_FILE_XY) ? 2 : 1;
+    s.reducer = reducer;
+    s.page = (size_t)sysconf(_SC_PAGESIZE);
+    s.fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (s.fd < 0 || fstat(s.fd, &st) != 0) {
+        fprintf(stderr, "cannot open %s\n", path);
+        if (s.fd >= 0)
+            close(s.fd);
+        return -1;
+    }
+    s.n = (uint64_t)st.st_size / (s.cols * sizeof(double));
+    if (s.n < 1) {
+        fprintf(stderr, "no records in %s\n", path);
+        close(s.fd);
+        return -1;
+    }
+
+    if (flags & GNUPLOT_FILE_MMAP) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, s.fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            s.map = (const char*)map;
+        }
+    }
+    if (s.map == NULL)
+        posix_fadvise(s.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // LTTB keeps the first and last points and picks one per bucket between,
+    // min/max two per bucket; files that fit in target are sent whole
+    target = (target > 3) ? target : 3;
+    if (s.n <= target)
+        s.reducer = GNUPLOT_REDUCE_MINMAX;
+    if (s.reducer == GNUPLOT_REDUCE_LTTB) {
+        s.first = 1;
+        s.span = s.n - 2;
+        s.nbuckets = target - 2;
+    } else {
+        s.span = s.n;
+        s.nbuckets = (s.n <= target) ? (uint32_t)s.n : target / 2;
+    }
+
+    double* out = (double*)malloc((size_t)target * 2 * sizeof(double));
+    s.buckets = (gnuplot_file_bucket*)calloc(s.nbuckets, sizeof(gnuplot_file_bucket));
+    if (out == NULL || s.buckets == NULL) {
+        fprintf(stderr, "out of memory reducing %s\n", path);
+        s.failed = 1;
+    }
+    for (uint32_t b = 0; !s.failed && b < s.nbuckets; b++) {
+        s.buckets[b].lo = s.buckets[b].hi = UINT64_MAX;
+    }
+
+    if (!s.failed && s.reducer == GNUPLOT_REDUCE_LTTB) {
+        double first[2];
+        double last[2];
+        const double* v = gnuplot_file_window(&s, first, 0, 1);
+        const double* w = gnuplot_file_window(&s, last, s.n - 1, 1);
+        if (v == NULL || w == NULL) {
+            s.failed = 1;
+        } else {
+            s.ax = (s.cols == 2) ? v[0] : 0.0;
+            s.ay = v[s.cols - 1];
+            s.zx = (s.cols == 2) ? w[0] : (double)(s.n - 1);
+            s.zy = w[s.cols - 1];
+        }
+    }
+
+    uint32_t passes = (s.reducer == GNUPLOT_REDUCE_LTTB) ? 2 : 1;
+    s.nthreads = gnuplot_nthreads(s.span / (GNUPLOT_FILE_CHUNK / (s.cols * sizeof(double))) + 1,
+        (s.map != NULL) ? 0 : GNUPLOT_FILE_CHUNK);
+    s.nthreads = (s.nthreads < s.nbuckets) ? s.nthreads : s.nbuckets;
+    for (s.pass = 0; !s.failed && s.pass < passes; s.pass++) {
+        gnuplot_parallel(s.nthreads, gnuplot_file_chunk, &s);
+    }
+    if (s.failed && out != NULL && s.buckets != NULL)
+        fprintf(stderr, "cannot read %s\n", path);
+
+    uint32_t m = 0;
+    if (!s.failed) {
+        if (s.reducer == GNUPLOT_REDUCE_LTTB && !isnan(s.ax) && !isnan(s.ay)) {
+            out[2 * m] = s.ax;
+            out[2 * m++ + 1] = s.ay;
+        }
+        for (uint32_t b = 0; b < s.nbuckets; b++) {
+            const gnuplot_file_bucket* bucket = s.buckets + b;
+            if (bucket->lo == UINT64_MAX)
+                continue;
+            // in the order of the file
+            int swap = bucket->hi != UINT64_MAX && bucket->hi < bucket->lo;
+            out[2 * m] = swap ? bucket->hi_x : bucket->lo_x;
+            out[2 * m++ + 1] = swap ? bucket->hi_y : bucket->lo_y;
+            if (bucket->hi != UINT64_MAX && bucket->hi != bucket->lo) {
+                out[2 * m] = swap ? bucket->lo_x : bucket->hi_x;
+                out[2 * m++ + 1] = swap ? bucket->lo_y : bucket->hi_y;
+            }
+        }
+        if (s.reducer == GNUPLOT_REDUCE_LTTB && !isnan(s.zx) && !isnan(s.zy)) {
+            out[2 * m] = s.zx;
+            out[2 * m++ + 1] = s.zy;
+        }
+    }
+
+    if (s.map != NULL)
+        munmap((void*)s.map, (size_t)st.st_size);
+    close(s.fd);
+    free(s.buckets);
+
+    if (s.failed || m == 0) {
+        free(out);
+        return -1;
+    }
+
+    gnuplot_cmd(handle, "%s '-' binary record=(%u) format='%%float64%%float64' using 1:2 title \"%s\" with %s",
+        cmd, m, title, handle->pstyle);
+    fwrite(out, 2 * sizeof(double), m, handle->gnucmd);
+    fflush(handle->gnucmd);
+    free(out);
+
+    handle->nplots++;
+    return 0;
+#endif // #ifdef _WIN32
+}
+
+/*---------------------------------------------------------------------------
+                            Shared sample ring
+ ---------------------------------------------------------------------------*/
+
+#ifdef __linux__
+static gnuplot_ring* gnuplot_ring_map(int fd, size_t size)
+{
+    gnuplot_ring* ring;
+
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    ring = (gnuplot_ring*)calloc(1, sizeof(gnuplot_ring));
+    if (ring == NULL) {
+        munmap(p, size);
+        return NULL;
+    }
+    ring->shm = (gnuplot_ring_shm*)p;
+    ring->data = (double*)((char*)p + sizeof(gnuplot_ring_shm));
+    ring->size = size;
+    ring->fd = fd;
+    ring->mask = ring->shm->capacity - 1;
+    ring->seen = __atomic_load_n(&ring->shm->head, __ATOMIC_ACQUIRE);
+
+    return ring;
+}
+
+gnuplot_ring* gnuplot_ring_create(uint32_t capacity)
+{
+    uint32_t cap = 1;
+
+    while (cap < capacity && cap < (1u << 31)) {
+        cap <<= 1;
+    }
+    size_t size = sizeof(gnuplot_ring_shm) + (size_t)cap * 2 * sizeof(double);
+
+    int fd = (int)syscall(SYS_memfd_create, "gnuplot_ring", MFD_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, (off_t)size) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    // the header has to be there before anybody maps the ring
+    gnuplot_ring_shm shm;
+    memset(&shm, 0, sizeof(shm));
+    shm.magic = GNUPLOT_RING_MAGIC;
+    shm.capacity = cap;
+    if (pwrite(fd, &shm, sizeof(shm), 0) != (ssize_t)sizeof(shm)) {
+        close(fd);
+        return NULL;
+    }
+
+    gnuplot_ring* ring = gnuplot_ring_map(fd, size);
+    if (ring == NULL)
+        close(fd);
+    return ring;
+}
+
+gnuplot_ring* gnuplot_ring_attach(int fd)
+{
+    gnuplot_ring_shm shm;
+    struct stat st;
+
+    if (pread(fd, &shm, sizeof(shm), 0) != (ssize_t)sizeof(shm) || fstat(fd, &st) != 0)
+        return NULL;
+    size_t size = sizeof(gnuplot_ring_shm) + (size_t)shm.capacity * 2 * sizeof(double);
+    if (shm.magic != GNUPLOT_RING_MAGIC || shm.capacity == 0
+        || (shm.capacity & (shm.capacity - 1)) != 0 || (size_t)st.st_size < size)
+        return NULL;
+
+    int dup = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (dup < 0)
+        return NULL;
+    gnuplot_ring* ring = gnuplot_ring_map(dup, size);
+    if (ring == NULL)
+        close(dup);
+    return ring;
+}
+
+int gnuplot_ring_fd(const gnuplot_ring* ring)
+{
+    return ring->fd;
+}
+
+uint32_t gnuplot_ring_push(
+    gnuplot_ring* ring,
+    const double* x,
+    const double* y,
+    uint32_t n)
+{
+    gnuplot_ring_shm* shm = ring->shm;
+
+    uint64_t head = shm->head;
+    uint64_t tail = __atomic_load_n(&shm->tail, __ATOMIC_ACQUIRE);
+    uint64_t room = (uint64_t)shm->capacity - (head - tail);
+    uint32_t m = (n < room) ? n : (uint32_t)room;
+
+    for (uint32_t i = 0; i < m; i++) {
+        double* p = ring->data + 2 * ((head + i) & ring->mask);
+        p[0] = (x != NULL) ? x[i] : (double)(head + i);
+        p[1] = y[i];
+    }
+    if (m < n)
+        __atomic_add_fetch(&shm->dropped, n - m, __ATOMIC_RELAXED);
+    if (m == 0)
+        return 0;
+
+    __atomic_store_n(&shm->head, head + m, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&shm->seq, 1, __ATOMIC_SEQ_CST);
+    // only pay for the system call when the consumer sleeps
+    if (__atomic_load_n(&shm->waiting, __ATOMIC_SEQ_CST))
+        syscall(SYS_futex, &shm->seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+
+    return m;
+}
+
+uint32_t gnuplot_ring_read(
+    gnuplot_ring* ring,
+    double* x,
+    double* y,
+    uint32_t max)
+{
+    gnuplot_ring_shm* shm = ring->shm;
+
+    uint64_t head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = shm->tail;
+    uint32_t m = (head - tail < max) ? (uint32_t)(head - tail) : max;
+
+    for (uint32_t i = 0; i < m; i++) {
+        const double* p = ring->data + 2 * ((tail + i) & ring->mask);
+        if (x != NULL)
+            x[i] = p[0];
+        if (y != NULL)
+            y[i] = p[1];
+    }
+
+    __atomic_store_n(&shm->tail, tail + m, __ATOMIC_RELEASE);
+    ring->seen = head;
+    return m;
+}
+
+int gnuplot_ring_wait(gnuplot_ring* ring, int timeout_ms)
+{
+    gnuplot_ring_shm* shm = ring->shm;
+    uint64_t deadline = gnuplot_now() + (uint64_t)timeout_ms * 1000000;
+
+    for (;;) {
+        __atomic_store_n(&shm->waiting, 1, __ATOMIC_SEQ_CST);
+        uint32_t seq = __atomic_load_n(&shm->seq, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&shm->head, __ATOMIC_ACQUIRE) != ring->seen) {
+            __atomic_store_n(&shm->waiting, 0, __ATOMIC_RELAXED);
+            return 1;
+        }
+
+        struct timespec ts;
+        struct timespec* pts = NULL;
+        if (timeout_ms >= 0) {
+            uint64_t t = gnuplot_now();
+            if (t >= deadline)
+                break;
+            ts.tv_sec = (time_t)((deadline - t) / 1000000000);
+            ts.tv_nsec = (long)((deadline - t) % 1000000000);
+            pts = &ts;
+        }
+        syscall(SYS_futex, &shm->seq, FUTEX_WAIT, seq, pts, NULL, 0);
+    }
+
+    __atomic_store_n(&shm->waiting, 0, __ATOMIC_RELAXED);
+    return 0;
+}
+
+uint64_t gnuplot_ring_dropped(const gnuplot_ring* ring)
+{
+    return __atomic_load_n(&ring->shm->dropped, __ATOMIC_RELAXED);
+}
+
+void gnuplot_ring_close(gnuplot_ring* ring)
+{
+    munmap(ring->shm, ring->size);
+    close(ring->fd);
+    free(ring);
+}
+
+void gnuplot_plot_ring(
+    gnuplot_ctrl* handle,
+    gnuplot_ring* ring,
+    uint32_t window,
+    const char* title)
+{
+    if (handle == NULL || ring == NULL)
+        return;
+    gnuplot_ring_shm* shm = ring->shm;
+
+    uint64_t head = __atomic_load_n(&shm->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = shm->tail;
+    ring->seen = head;
+    if (window == 0 || window > shm->capacity)
+        window = shm->capacity;
+    uint64_t start = (head - tail > window) ? head - window : tail;
+    if (start == head)
+        return;
+
+    const char* cmd = (handle->multiplot == 0 && handle->nplots > 0) ? "replot" : "plot";
+    title = (title == NULL) ? "(none)" : title;
+
+    gnuplot_cmd(handle, "%s '-' title \"%s\" with %s",
+        cmd, title, handle->pstyle);
+
+    for (uint64_t i = start; i < head; i++) {
+        const double* p = ring->data + 2 * (i & ring->mask);
+        gnuplot_printf(handle, "%18e %18e", p[0], p[1]);
+    }
+    gnuplot_cmd(handle, "e");
+
+    // keep the samples of this frame, the producer may reuse the older ones;
+    // at most half the ring, so that the producer always has room left
+    uint32_t keep = (window < shm->capacity / 2) ? window : shm->capacity / 2;
+    uint64_t release = (head - start > keep) ? head - keep : start;
+    __atomic_store_n(&shm->tail, release, __ATOMIC_RELEASE);
+
+    handle->nplots++;
+}
+#else
+gnuplot_ring* gnuplot_ring_create(uint32_t capacity)
+{
+    (void)capacity;
+    return NULL;
+}
+
+gnuplot_ring* gnuplot_ring_attach(int fd)
+{
+    (void)fd;
+    return NULL;
+}
+
+// no ring can be created, the functions below are never reached
+
+int gnuplot_ring_fd(const gnuplot_ring* ring)
+{
+    (void)ring;
+    return -1;
+}
+
+uint32_t gnuplot_ring_push(gnuplot_ring* ring, const double* x, const double* y, uint32_t n)
+{
+    (void)ring;
+    (void)x;
+    (void)y;
+    (void)n;
+    return 0;
+}
+
+uint32_t gnuplot_ring_read(gnuplot_ring* ring, double* x, double* y, uint32_t max)
+{
+    (void)ring;
+    (void)x;
+    (void)y;
+    (void)max;
+    return 0;
+}
+
+int gnuplot_ring_wait(gnuplot_ring* ring, int timeout_ms)
+{
+    (void)ring;
+    (void)timeout_ms;
+    return 0;
+}
+
+uint64_t gnuplot_ring_dropped(const gnuplot_ring* ring)
+{
+    (void)ring;
+    return 0;
+}
+
+void gnuplot_ring_close(gnuplot_ring* ring)
+{
+    (void)ring;
+}
+
+void gnuplot_plot_ring(gnuplot_ctrl* handle, gnuplot_ring* ring, uint32_t window, const char* title)
+{
+    (void)handle;
+    (void)ring;
+    (void)window;
+    (void)title;
+}
+#endif // #ifdef __linux__
+
 /* vim: set ts=4 et sw=4 tw=80 */
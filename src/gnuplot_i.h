@@ -34,10 +34,166 @@ extern "C" {
 #include <stdio.h>
 #include <stdint.h>
 
+/*---------------------------------------------------------------------------
+                                Defines
+ ---------------------------------------------------------------------------*/
+
+// exported symbols when built as a shared library with -fvisibility=hidden
+#if defined(__GNUC__) && __GNUC__ >= 4
+#define GNUPLOT_API __attribute__((visibility("default")))
+#else
+#define GNUPLOT_API
+#endif // #if defined(__GNUC__) && __GNUC__ >= 4
+
+// priority classes of gnuplot_loop_add()
+#define GNUPLOT_PRIO_INTERACTIVE 0 // served first, without limit
+#define GNUPLOT_PRIO_BATCH 1 // served round robin, a quantum per turn
+
+// what gnuplot_set_budget() does to a handle over its byte rate
+#define GNUPLOT_BUDGET_BLOCK 0 // writes wait for the budget
+#define GNUPLOT_BUDGET_DECIMATE 1 // frames are cut to the points the budget has
+#define GNUPLOT_BUDGET_DROP 2 // frames are skipped until the budget recovers
+
+// settings of a gnuplot_sched
+#define GNUPLOT_SCHED_AFFINITY 1 // run on the CPUs of cpus only
+#define GNUPLOT_SCHED_NICE 2 // run at the nice value nice
+#define GNUPLOT_SCHED_IDLE 4 // run under SCHED_IDLE, when nothing else wants the CPU
+#define GNUPLOT_SCHED_OOM 8 // set oom_score_adj of gnuplot
+// CPUs a gnuplot_sched can name
+#define GNUPLOT_SCHED_CPUS 1024
+
+// colormaps of gnuplot_plot_density()
+#define GNUPLOT_CMAP_PALETTE 0 // gnuplot palette ("with image")
+#define GNUPLOT_CMAP_GRAY 1
+#define GNUPLOT_CMAP_HOT 2
+#define GNUPLOT_CMAP_VIRIDIS 3
+
+// flags of gnuplot_plot_density()
+#define GNUPLOT_DENSITY_LOG 1 // logarithmic color scale
+
+// windows of gnuplot_plot_spectrum()
+#define GNUPLOT_WINDOW_RECT 0
+#define GNUPLOT_WINDOW_HANN 1
+#define GNUPLOT_WINDOW_HAMMING 2
+#define GNUPLOT_WINDOW_BLACKMAN 3
+
+// methods of gnuplot_resample()
+#define GNUPLOT_RESAMPLE_LINEAR 0 // linear interpolation
+#define GNUPLOT_RESAMPLE_PREVIOUS 1 // last value at or before
+#define GNUPLOT_RESAMPLE_NEAREST 2 // closest value
+
+// methods of gnuplot_grid_scattered()
+#define GNUPLOT_GRID_BIN 0 // average of the points nearest each node
+#define GNUPLOT_GRID_IDW 1 // inverse distance weighting
+
+// record layouts of gnuplot_plot_file(), native float64 values
+#define GNUPLOT_FILE_Y 0 // y, x is the record number
+#define GNUPLOT_FILE_XY 1 // x then y
+
+// reducers of gnuplot_plot_file()
+#define GNUPLOT_REDUCE_MINMAX 0 // smallest and largest y of each bucket
+#define GNUPLOT_REDUCE_LTTB 1 // largest triangle three buckets
+
+// flags of gnuplot_plot_file()
+#define GNUPLOT_FILE_MMAP 1 // map the file instead of reading it
+
 /*---------------------------------------------------------------------------
                                 New Types
  ---------------------------------------------------------------------------*/
 
+/*--------------------------------------------------------------------------*/
+/**
+  @typedef  gnuplot_stats
+  @brief    Resource usage of the gnuplot child process.
+
+  This structure is filled by gnuplot_monitor() from /proc/<pid>/stat.
+  CPU time and RSS describe the current child only, they start again
+  from zero when the child is respawned. All fields stay zero on systems
+  without procfs.
+ */
+/*--------------------------------------------------------------------------*/
+
+typedef struct _GNUPLOT_STATS_ {
+    /** CPU time (user + system) of the gnuplot process, in nanoseconds */
+    uint64_t cpu_ns;
+    /** Resident set size of the gnuplot process, in bytes */
+    uint64_t rss;
+    /** Largest resident set size seen so far, in bytes */
+    uint64_t rss_peak;
+    /** Number of samples taken */
+    uint64_t samples;
+    /** Number of times gnuplot was killed and respawned */
+    uint64_t respawns;
+    /** Number of write() calls to the pipe */
+    uint64_t writes;
+    /** Number of bytes written to the pipe */
+    uint64_t bytes;
+    /** Total time spent in write() on the pipe, in nanoseconds */
+    uint64_t write_ns;
+    /** Total time writes waited for the byte budget, in nanoseconds */
+    uint64_t throttled_ns;
+    /** Number of frames cut down to fit the byte budget */
+    uint64_t decimated;
+    /** Number of frames skipped for lack of byte budget */
+    uint64_t dropped;
+} gnuplot_stats;
+
+/** Number of sub-buckets per power of two in gnuplot_hist (log2) */
+#define GNUPLOT_HIST_SUB_BITS 4
+/** Number of buckets in gnuplot_hist */
+#define GNUPLOT_HIST_BUCKETS ((64 - GNUPLOT_HIST_SUB_BITS + 1) << GNUPLOT_HIST_SUB_BITS)
+
+/*--------------------------------------------------------------------------*/
+/**
+  @typedef  gnuplot_hist
+  @brief    Log-bucketed histogram of 64-bit values.
+
+  Values below 16 are counted exactly, larger values fall in one of 16
+  linear sub-buckets per power of two, so any value is known within
+  6.25%. Histograms have a fixed layout and can be merged by summing
+  their buckets with gnuplot_hist_merge().
+
+  Each handle keeps two of them: the time spent in every write() to the
+  gnuplot pipe, and the number of bytes still waiting in the pipe when a
+  write is submitted.
+ */
+/*--------------------------------------------------------------------------*/
+
+typedef struct _GNUPLOT_HIST_ {
+    /** Number of recorded values */
+    uint64_t count;
+    /** Sum of recorded values */
+    uint64_t sum;
+    /** Smallest recorded value */
+    uint64_t min;
+    /** Largest recorded value */
+    uint64_t max;
+    /** Counts per bucket */
+    uint64_t buckets[GNUPLOT_HIST_BUCKETS];
+} gnuplot_hist;
+
+/*--------------------------------------------------------------------------*/
+/**
+  @typedef  gnuplot_sched
+  @brief    Where and how gnuplot processes and library threads are scheduled.
+
+  Only the settings named in flags are applied, the others are left as
+  inherited from the calling process. A CPU i is in the set when bit
+  i % 64 of cpus[i / 64] is set. Settings are only applied on Linux.
+ */
+/*--------------------------------------------------------------------------*/
+
+typedef struct _GNUPLOT_SCHED_ {
+    /** Settings to apply, GNUPLOT_SCHED_ values or'ed together */
+    uint32_t flags;
+    /** CPUs allowed with GNUPLOT_SCHED_AFFINITY */
+    uint64_t cpus[GNUPLOT_SCHED_CPUS / 64];
+    /** Nice value with GNUPLOT_SCHED_NICE, from -20 to 19 */
+    int32_t nice;
+    /** oom_score_adj with GNUPLOT_SCHED_OOM, from -1000 to 1000 */
+    int32_t oom_score_adj;
+} gnuplot_sched;
+
 /*--------------------------------------------------------------------------*/
 /**
   @typedef  gnuplot_ctrl
@@ -65,8 +221,207 @@ typedef struct _GNUPLOT_CTRL_ {
     char pstyle[128];
     /** If we are in multiplot */
     uint32_t multiplot;
+
+    /** Process id of gnuplot, 0 if unknown */
+    int32_t pid;
+    /** If gnuplot could not be respawned, commands are dropped until it is */
+    uint32_t dead;
+    /** Resource usage of gnuplot */
+    gnuplot_stats stats;
+    /** Resource sampling interval in ms, 0 if disabled */
+    uint32_t monitor_ms;
+    /** Time of the last sample, in ns (monotonic clock) */
+    uint64_t monitor_last;
+    /** Respawn gnuplot above this RSS in bytes, 0 for no limit */
+    uint64_t rss_limit;
+    /** Respawn gnuplot above this CPU time in ns, 0 for no limit */
+    uint64_t cpu_limit;
+
+    /** File descriptor of the pipe to gnuplot, -1 if unknown */
+    int32_t fd;
+    /** Time blocked in each write() to the pipe, in ns */
+    gnuplot_hist write_hist;
+    /** Bytes waiting in the pipe when each write() is submitted */
+    gnuplot_hist queue_hist;
+
+    /** Read end of the pipe gnuplot answers on, -1 if none */
+    int32_t ack;
+    /** Sequence number of the last gnuplot_sync() request */
+    uint32_t sync_seq;
+    /** Socket to gnuplotd if the session comes from it, -1 otherwise */
+    int32_t daemon;
+
+    /** Datablocks defined since the last gnuplot_resetplot() */
+    uint32_t nblocks;
+    /** If gnuplot_plot_x_multi_y() sends a single datablock */
+    uint32_t datablock;
+    /** FFT state kept by gnuplot_plot_spectrum(), NULL if none */
+    struct _GNUPLOT_SPECTRUM_* spectrum;
+
+    /** Time budget of a frame in ns, 0 if the level of detail is not managed */
+    uint64_t lod_budget_ns;
+    /** Bounds and current number of points of a frame */
+    uint32_t lod_min;
+    uint32_t lod_max;
+    uint32_t lod_points;
+    /** Points gnuplot takes per ns, moving average */
+    double lod_rate;
+
+    /** Samples per pixel of gnuplot_plot_equation(), 0 to leave samples alone */
+    double samples_oversample;
+    /** Width of the plot in pixels, 0 until known */
+    uint32_t samples_width;
+    /** Samples last set by the library, 0 if gnuplot may have others */
+    uint32_t samples;
+
+    /** Byte rate allowed to the pipe in bytes per second, 0 for no limit */
+    uint64_t budget_rate;
+    /** Most bytes that can go out at once after an idle time */
+    uint64_t budget_burst;
+    /** What happens over the rate, one of the GNUPLOT_BUDGET_ values */
+    uint32_t budget_policy;
+    /** Bytes the handle can still send, negative when in debt */
+    double budget_tokens;
+    /** Time the tokens were last counted, in ns (monotonic clock) */
+    uint64_t budget_last;
+
+    /** Template applied to gnuplot, again on every respawn, NULL if none */
+    struct _GNUPLOT_TEMPLATE_* tmpl;
+    /** Scheduling of gnuplot, applied again on every respawn */
+    gnuplot_sched sched;
+    /** If a gnuplotd worker got our scheduling, it is replaced on close */
+    uint32_t resched;
+
+    /** Event loop writing for the handle, NULL if writes go to the pipe */
+    struct _GNUPLOT_LOOP_* loop;
+    /** Priority class in the loop, one of the GNUPLOT_PRIO_ values */
+    uint32_t prio;
+    /** Bytes waiting for the loop, those in [queue_head, queue_tail) */
+    char* queue;
+    size_t queue_head;
+    size_t queue_tail;
+    size_t queue_size;
 } gnuplot_ctrl;
 
+/*--------------------------------------------------------------------------*/
+/**
+  @typedef  gnuplot_pool
+  @brief    Pool of warm gnuplot sessions (opaque type).
+
+  A pool keeps a number of gnuplot processes started in advance, so that
+  getting a session does not wait for gnuplot to start. It is built by
+  gnuplot_pool_init() and closed by gnuplot_pool_close().
+
+  A pool is not thread-safe.
+ */
+/*--------------------------------------------------------------------------*/
+
+typedef struct _GNUPLOT_POOL_ gnuplot_pool;
+
+/*--------------------------------------------------------------------------*/
+/**
+  @typedef  gnuplot_template
+  @brief    Preamble of commands shared by sessions (opaque type).
+
+  A template collects commands with gnuplot_template_cmd(). The first
+  gnuplot_template_apply() writes them to a file, in /dev/shm when it
+  exists, which every session then runs with a single "load" command.
+  Templates are closed by gnuplot_template_close().
+ */
+/*--------------------------------------------------------------------------*/
+
+typedef struct _GNUPLOT_TEMPLATE_ gnuplot_template;
+
+/*--------------------------------------------------------------------------*/
+/**
+  @typedef  gnuplot_session
+  @brief    Saved state of a gnuplot session (opaque type).
+
+  Taken by gnuplot_snapshot(), restored in new sessions by
+  gnuplot_clone() and closed by gnuplot_session_close().
+ */
+/*--------------------------------------------------------------------------*/
+
+typedef struct _GNUPLOT_SESSION_ gnuplot_session;
+
+/*--------------------------------------------------------------------------*/
+/**
+  @typedef  gnuplot_loop
+  @brief    Writes the commands of several handles without blocking (opaque type).
+
+  Handles added to a loop no longer write to their pipe themselves:
+  what they send is queued, and written by gnuplot_loop_run() as each
+  gnuplot process takes it. Handles are in one of two priority classes:
+
+  - GNUPLOT_PRIO_INTERACTIVE handles are written first and as much as
+    their pipe takes, again between every batch handle served.
+  - GNUPLOT_PRIO_BATCH handles are served round robin, at most a
+    quantum of bytes each per turn.
+
+  A dashboard that redraws often thus keeps its latency while exports
+  push bulk data through the same loop. A loop is not thread-safe.
+ */
+/*--------------------------------------------------------------------------*/
+
+typedef struct _GNUPLOT_LOOP_ gnuplot_loop;
+
+/** Plots frame i of an export on handle, see gnuplot_export_frames() */
+typedef void (*gnuplot_frame_fn)(gnuplot_ctrl* handle, uint32_t i, void* user);
+/** Receives the bytes of frame i of an export, returns 0 to go on */
+typedef int (*gnuplot_sink_fn)(uint32_t i, const void* data, size_t size, void* user);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @typedef  gnuplot_ring
+  @brief    Shared memory ring of samples between two processes (opaque type).
+
+  A ring lives in a memfd mapped by a producer process, which appends
+  (x, y) samples to it, and by a display process, which plots them with
+  gnuplot_plot_ring() straight from the shared memory. There is exactly
+  one producer and one consumer; neither takes a lock nor makes a system
+  call in the common case, the consumer is woken up through a futex.
+
+  The ring is created by one side with gnuplot_ring_create(), and the
+  other side maps it with gnuplot_ring_attach() on the file descriptor
+  from gnuplot_ring_fd(), inherited through fork() or passed with
+  SCM_RIGHTS.
+
+  Only available on Linux.
+ */
+/*--------------------------------------------------------------------------*/
+
+typedef struct _GNUPLOT_RING_ gnuplot_ring;
+
+/*--------------------------------------------------------------------------*/
+/**
+  @typedef  gnuplot_waterfall
+  @brief    Scrolling spectrogram of a stream of samples (opaque type).
+
+  Built by gnuplot_waterfall_init(), fed with gnuplot_waterfall_feed()
+  or gnuplot_waterfall_feed_ring(), drawn by gnuplot_waterfall_draw()
+  and freed by gnuplot_waterfall_close().
+ */
+/*--------------------------------------------------------------------------*/
+
+typedef struct _GNUPLOT_WATERFALL_ gnuplot_waterfall;
+
+/*--------------------------------------------------------------------------*/
+/**
+  @typedef  gnuplot_ohlc
+  @brief    Open, high, low, close and volume of ticks over an interval.
+ */
+/*--------------------------------------------------------------------------*/
+
+typedef struct _GNUPLOT_OHLC_ {
+    /** Start of the interval */
+    double t;
+    double open;
+    double high;
+    double low;
+    double close;
+    double volume;
+} gnuplot_ohlc;
+
 /*---------------------------------------------------------------------------
                         Function ANSI C prototypes
  ---------------------------------------------------------------------------*/
@@ -80,10 +435,87 @@ typedef struct _GNUPLOT_CTRL_ {
   controlling a gnuplot session should remain opaque and only be
   accessed through the provided functions.
 
+  If the GNUPLOTD_SOCKET environment variable is set, the session is
+  taken from the gnuplotd daemon listening there, see gnuplot_connect().
+  When the daemon cannot be reached, a gnuplot process of our own is
+  started as usual.
+
   The session must be closed using gnuplot_close().
  */
 /*--------------------------------------------------------------------------*/
-gnuplot_ctrl* gnuplot_init(void);
+GNUPLOT_API gnuplot_ctrl* gnuplot_init(void);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Opens up a gnuplot session served by a gnuplotd daemon.
+  @param    path    Path of the Unix socket gnuplotd listens on.
+  @return   Newly allocated gnuplot control structure, NULL on error.
+
+  gnuplotd keeps a pool of warm gnuplot processes for the whole host.
+  The daemon passes the pipes of one of them over the socket, so the
+  session is then used exactly like one from gnuplot_init(): commands
+  and data go straight to gnuplot, not through the daemon.
+
+  gnuplot_close() gives the process back to the daemon, which resets it
+  with "reset session" for the next client. If the client exits without
+  closing, the process is killed and replaced.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API gnuplot_ctrl* gnuplot_connect(const char* path);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Sets the scheduling of new handles and library threads.
+  @param    sched   Settings, NULL for none.
+  @return   void
+
+  Handles opened afterwards by gnuplot_init(), gnuplot_connect() or a
+  pool start with these settings. SCHED_IDLE is set by posix_spawn
+  before gnuplot runs; the affinity, nice value and oom_score_adj are
+  applied right after the spawn, so gnuplot starts without them for a
+  moment. A worker of gnuplotd gets them all once handed over, through
+  the pid the daemon reports. Since the daemon may not be allowed to
+  undo them, gnuplot_close() then waits for the worker to finish and
+  has the daemon kill it and start a new one, instead of giving it
+  back to the next client.
+
+  Threads the library starts to split work, in gnuplot_plot_file(),
+  gnuplot_export_frames() and the other parallel functions, apply the
+  affinity, nice value and SCHED_IDLE to themselves when they start;
+  the calling thread, which takes part of the work, is left alone.
+
+  It is meant to be called once, before any other function.
+
+  Example:
+
+  @code
+    // keep plotting off the cores 0 to 3 of the trading threads
+    gnuplot_sched sched = { GNUPLOT_SCHED_AFFINITY | GNUPLOT_SCHED_IDLE | GNUPLOT_SCHED_OOM };
+    for (int cpu = 4; cpu < 8; cpu++)
+        sched.cpus[cpu / 64] |= 1ull << (cpu % 64);
+    sched.oom_score_adj = 500;
+    gnuplot_set_default_sched(&sched);
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_set_default_sched(const gnuplot_sched* sched);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Sets the scheduling of the gnuplot of a handle.
+  @param    handle  Gnuplot session control handle.
+  @param    sched   Settings, NULL for none.
+  @return   0 if every setting was applied, -1 otherwise.
+
+  The settings are applied to the running gnuplot at once, and to the
+  ones spawned later when gnuplot_monitor() replaces it. Lowering the
+  priority of gnuplot is always allowed, raising it back or lowering
+  oom_score_adj needs privileges. Settings set to none leave gnuplot as
+  it is. A worker of gnuplotd whose settings were changed is replaced
+  by the daemon when the handle is closed.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API int gnuplot_set_sched(gnuplot_ctrl* handle, const gnuplot_sched* sched);
 
 /*--------------------------------------------------------------------------*/
 /**
@@ -97,7 +529,7 @@ gnuplot_ctrl* gnuplot_init(void);
 
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_close(gnuplot_ctrl* handle);
+GNUPLOT_API void gnuplot_close(gnuplot_ctrl* handle);
 
 /*--------------------------------------------------------------------------*/
 /**
@@ -123,7 +555,7 @@ void gnuplot_close(gnuplot_ctrl* handle);
   back from gnuplot.
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_cmd(gnuplot_ctrl* handle, const char* cmd, ...);
+GNUPLOT_API void gnuplot_cmd(gnuplot_ctrl* handle, const char* cmd, ...);
 
 /*--------------------------------------------------------------------------*/
 /**
@@ -153,7 +585,36 @@ void gnuplot_cmd(gnuplot_ctrl* handle, const char* cmd, ...);
   back from gnuplot.
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_printf(gnuplot_ctrl* handle, const char* cmd, ...);
+GNUPLOT_API void gnuplot_printf(gnuplot_ctrl* handle, const char* cmd, ...);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Waits until gnuplot has executed every command sent so far.
+  @param    handle      Gnuplot session control handle.
+  @param    timeout_ms  Timeout in ms, -1 to wait forever.
+  @return   0 on success, -1 on timeout or if gnuplot is gone.
+
+  Flushes the pending commands and has gnuplot print a tagged line back
+  to the library on its file descriptor 3. Since gnuplot runs its input
+  in order, once the answer is read every previous command, including
+  the rendering of the last plot, is done.
+
+  This sends "set print" commands, so a "set print" made by the user is
+  reset to its default (stderr).
+
+  Example:
+
+  @code
+    gnuplot_cmd(h, "set terminal png");
+    gnuplot_cmd(h, "set output \"sine.png\"");
+    gnuplot_plot_equation(h, "sin(x)", "sine");
+    gnuplot_cmd(h, "unset output");
+    // sine.png is complete once this returns 0
+    gnuplot_sync(h, 5000);
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API int gnuplot_sync(gnuplot_ctrl* handle, int timeout_ms);
 
 /*--------------------------------------------------------------------------*/
 /**
@@ -167,7 +628,7 @@ void gnuplot_printf(gnuplot_ctrl* handle, const char* cmd, ...);
 
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_multiplot(gnuplot_ctrl* handle, const char* opt);
+GNUPLOT_API void gnuplot_multiplot(gnuplot_ctrl* handle, const char* opt);
 
 /*--------------------------------------------------------------------------*/
 /**
@@ -190,7 +651,119 @@ void gnuplot_multiplot(gnuplot_ctrl* handle, const char* opt);
   - boxeserrorbars
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_setstyle(gnuplot_ctrl* handle, const char* plot_style);
+GNUPLOT_API void gnuplot_setstyle(gnuplot_ctrl* handle, const char* plot_style);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Send the lists of gnuplot_plot_x_multi_y() in one datablock.
+  @param    handle Gnuplot session control handle
+  @param    enable 1 to send one datablock, 0 for one inline block per list
+  @return   void
+
+  By default gnuplot_plot_x_multi_y() sends every list as its own
+  inline block, repeating x on every line of each. With this mode on,
+  rows of x, y[0] ... y[l - 1] are sent once as a datablock, that a
+  single plot command reads "using 1:2", "using 1:3" and so on. This
+  sends x + l * y values instead of l * (x + y), and gnuplot parses
+  the data once.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_set_datablock(gnuplot_ctrl* handle, uint32_t enable);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Keep frames within a time budget by adjusting their detail.
+  @param    handle      Gnuplot session control handle.
+  @param    budget_ms   Time budget of a frame in ms, 0 to turn off.
+  @param    min_points  Fewest points of a frame.
+  @param    max_points  Most points of a frame.
+  @return   void
+
+  The handle learns how fast its gnuplot takes points: after each of
+  gnuplot_plot_x(), gnuplot_plot_multi_x(), gnuplot_plot_xy(),
+  gnuplot_plot_x_multi_y() and gnuplot_plot_multi_xy(), it waits for
+  gnuplot with gnuplot_sync() and keeps a moving average of points per
+  second. The next frame then gets as many points as fit the budget at
+  that rate, within [min_points, max_points], shared between its
+  series. Series longer than their share are reduced to the smallest
+  and largest value of each of share / 2 buckets, keeping peaks.
+
+  Detail drops as soon as gnuplot slows down, and climbs back, at most
+  doubling per frame, when frames take less than half the budget.
+  Frames start at max_points.
+
+  Example:
+
+  @code
+    gnuplot_set_lod(h, 30, 1000, 1000000);
+    for (;;) {
+        gnuplot_resetplot(h);
+        gnuplot_plot_xy(h, t, v, n, "signal");
+        printf("%u points\n", gnuplot_get_lod(h));
+    }
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_set_lod(
+    gnuplot_ctrl* handle,
+    uint32_t budget_ms,
+    uint32_t min_points,
+    uint32_t max_points);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Gets the number of points of the next frame.
+  @param    handle      Gnuplot session control handle.
+  @return   Points of the next frame, 0 if the level of detail is not managed.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API uint32_t gnuplot_get_lod(const gnuplot_ctrl* handle);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Limit the rate of bytes sent to gnuplot.
+  @param    handle  Gnuplot session control handle.
+  @param    rate    Bytes per second, 0 for no limit.
+  @param    burst   Most bytes sent at once after an idle time, 0 for rate.
+  @param    policy  One of the GNUPLOT_BUDGET_ values.
+  @return   void
+
+  The handle gets a token bucket of burst bytes, filled at rate bytes
+  per second, that every byte written to the pipe takes from. What
+  happens once it is empty depends on the policy:
+
+  - GNUPLOT_BUDGET_BLOCK: writes wait until the bucket has the bytes.
+    In a gnuplot_loop, the bytes stay queued instead, and the loop
+    sleeps until the bucket refills rather than polling the pipe.
+  - GNUPLOT_BUDGET_DECIMATE: gnuplot_plot_x(), gnuplot_plot_multi_x(),
+    gnuplot_plot_xy(), gnuplot_plot_x_multi_y() and
+    gnuplot_plot_multi_xy() send as many points as the bucket holds,
+    reduced to the smallest and largest values of buckets of the
+    series as gnuplot_set_lod() does, and at least 64 per series.
+    Datablocks of gnuplot_set_datablock() are sent whole.
+  - GNUPLOT_BUDGET_DROP: these functions send nothing while the bucket
+    is empty, the frame is lost.
+
+  Writes go past the bucket in the last two cases, which then stays in
+  debt until the rate has paid them back. The time spent waiting, the
+  frames cut and the frames dropped are counted in gnuplot_stats.
+
+  Bytes are only counted where writes to the pipe are timed (glibc),
+  elsewhere the budget has no effect.
+
+  Example:
+
+  @code
+    // 20 MB/s, 1 MB at once, skip frames the budget cannot take
+    gnuplot_set_budget(h, 20000000, 1000000, GNUPLOT_BUDGET_DROP);
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_set_budget(
+    gnuplot_ctrl* handle,
+    uint64_t rate,
+    uint64_t burst,
+    uint32_t policy);
 
 /*--------------------------------------------------------------------------*/
 /**
@@ -202,7 +775,7 @@ void gnuplot_setstyle(gnuplot_ctrl* handle, const char* plot_style);
   Sets the x label for a gnuplot session.
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_set_xlabel(gnuplot_ctrl* handle, const char* label);
+GNUPLOT_API void gnuplot_set_xlabel(gnuplot_ctrl* handle, const char* label);
 
 /*--------------------------------------------------------------------------*/
 /**
@@ -214,7 +787,7 @@ void gnuplot_set_xlabel(gnuplot_ctrl* handle, const char* label);
   Sets the y label for a gnuplot session.
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_set_ylabel(gnuplot_ctrl* handle, const char* label);
+GNUPLOT_API void gnuplot_set_ylabel(gnuplot_ctrl* handle, const char* label);
 
 /*--------------------------------------------------------------------------*/
 /**
@@ -224,9 +797,162 @@ void gnuplot_set_ylabel(gnuplot_ctrl* handle, const char* label);
 
   Resets a gnuplot session, i.e. the next plot will erase all previous
   ones.
+
+  This is also where the periodic resource sampling set up by
+  gnuplot_set_limits() happens.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_resetplot(gnuplot_ctrl* handle);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Sets up resource monitoring of the gnuplot process.
+  @param    handle      Gnuplot session control handle.
+  @param    interval_ms Sampling interval in ms, 0 disables sampling.
+  @param    rss_limit   RSS limit in bytes, 0 for no limit.
+  @param    cpu_limit   CPU time limit in ns, 0 for no limit.
+  @return   void
+
+  Once enabled, gnuplot_resetplot() samples the CPU time and RSS of the
+  gnuplot process whenever interval_ms has elapsed since the last sample.
+  If a limit is exceeded, gnuplot is killed and a fresh process is
+  started in its place.
+
+  A respawned gnuplot starts from a blank session: everything that was
+  set through gnuplot_cmd() is lost and has to be sent again. Limits are
+  only enforced at gnuplot_resetplot() or gnuplot_monitor(), never in the
+  middle of a plot.
+
+  Example:
+
+  @code
+    gnuplot_ctrl* h;
+
+    h = gnuplot_init();
+    // sample every second, respawn above 512 MiB
+    gnuplot_set_limits(h, 1000, 512 << 20, 0);
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_set_limits(
+    gnuplot_ctrl* handle,
+    uint32_t interval_ms,
+    uint64_t rss_limit,
+    uint64_t cpu_limit);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Samples the gnuplot process now and enforces the limits.
+  @param    handle Gnuplot session control handle.
+  @return   1 if gnuplot was respawned, 0 if not, -1 on error.
+
+  Reads CPU time and RSS of the gnuplot process from /proc/<pid>/stat
+  into the handle statistics, see gnuplot_get_stats(). If a limit set by
+  gnuplot_set_limits() is exceeded, gnuplot is killed and respawned.
+  If the respawn fails, commands sent to the handle are dropped, and
+  every later call tries to start gnuplot again.
+
+  Do not call this function between a plot command and its inline data.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API int gnuplot_monitor(gnuplot_ctrl* handle);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Gets the resource usage of the gnuplot process.
+  @param    handle Gnuplot session control handle.
+  @return   Pointer to the statistics of the handle.
+
+  The statistics are updated by gnuplot_monitor() and by the periodic
+  sampling enabled with gnuplot_set_limits().
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API const gnuplot_stats* gnuplot_get_stats(const gnuplot_ctrl* handle);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Gets the histogram of write() blocking times of a session.
+  @param    handle Gnuplot session control handle.
+  @return   Pointer to the histogram, values in nanoseconds.
+
+  Every write() of buffered data to the gnuplot pipe is timed. A slow
+  write means gnuplot does not consume its input fast enough and the
+  pipe is full.
+
+  Only available where the pipe can be wrapped (glibc), the histogram
+  stays empty elsewhere.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API const gnuplot_hist* gnuplot_get_write_hist(const gnuplot_ctrl* handle);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Gets the histogram of pipe queue depths of a session.
+  @param    handle Gnuplot session control handle.
+  @return   Pointer to the histogram, values in bytes.
+
+  Before every write() to the gnuplot pipe, the number of bytes written
+  earlier and not yet read by gnuplot is recorded.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API const gnuplot_hist* gnuplot_get_queue_hist(const gnuplot_ctrl* handle);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Clears a histogram.
+  @param    hist    Histogram to clear.
+  @return   void
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_hist_reset(gnuplot_hist* hist);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Records a value in a histogram.
+  @param    hist    Histogram.
+  @param    value   Value to record.
+  @return   void
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_hist_record(gnuplot_hist* hist, uint64_t value);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Adds the content of a histogram to another one.
+  @param    dst     Histogram receiving the counts.
+  @param    src     Histogram to add.
+  @return   void
+
+  Useful to get the distribution over several handles.
+
+  Example:
+
+  @code
+    gnuplot_hist all;
+    uint32_t i;
+
+    gnuplot_hist_reset(&all);
+    for (i = 0; i < nhandles; i++) {
+        gnuplot_hist_merge(&all, gnuplot_get_write_hist(h[i]));
+    }
+    printf("p99 write: %llu ns\n",
+        (unsigned long long)gnuplot_hist_percentile(&all, 99.0));
+  @endcode
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_resetplot(gnuplot_ctrl* handle);
+GNUPLOT_API void gnuplot_hist_merge(gnuplot_hist* dst, const gnuplot_hist* src);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Gets a percentile from a histogram.
+  @param    hist        Histogram.
+  @param    percentile  Percentile, between 0 and 100.
+  @return   Upper bound of the bucket holding the percentile, 0 if empty.
+
+  The result is clamped to the smallest and largest recorded values.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API uint64_t gnuplot_hist_percentile(const gnuplot_hist* hist, double percentile);
 
 /*--------------------------------------------------------------------------*/
 /**
@@ -258,7 +984,7 @@ void gnuplot_resetplot(gnuplot_ctrl* handle);
   @endcode
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_plot_x(
+GNUPLOT_API void gnuplot_plot_x(
     gnuplot_ctrl* handle,
     double* d,
     uint32_t n,
@@ -306,7 +1032,7 @@ void gnuplot_plot_x(
   @endcode
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_plot_multi_x(
+GNUPLOT_API void gnuplot_plot_multi_x(
     gnuplot_ctrl* handle,
     double** d,
     uint32_t n,
@@ -346,7 +1072,7 @@ void gnuplot_plot_multi_x(
   @endcode
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_plot_xy(
+GNUPLOT_API void gnuplot_plot_xy(
     gnuplot_ctrl* handle,
     double* x,
     double* y,
@@ -399,7 +1125,7 @@ void gnuplot_plot_xy(
   @endcode
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_plot_x_multi_y(
+GNUPLOT_API void gnuplot_plot_x_multi_y(
     gnuplot_ctrl* handle,
     double* x,
     double** y,
@@ -460,7 +1186,7 @@ void gnuplot_plot_x_multi_y(
   @endcode
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_plot_multi_xy(
+GNUPLOT_API void gnuplot_plot_multi_xy(
     gnuplot_ctrl* handle,
     double** x,
     double** y,
@@ -470,12 +1196,439 @@ void gnuplot_plot_multi_xy(
 
 /*--------------------------------------------------------------------------*/
 /**
-  @brief    Plot a slope on a gnuplot session.
-  @param    handle      Gnuplot session control handle.
-  @param    a           Slope.
-  @param    b           Intercept.
-  @param    title       Title of the plot.
-  @return   void
+  @brief    Resample a series on other x coordinates.
+  @param    x           Pointer to a list of x coordinates, in increasing order.
+  @param    y           Pointer to a list of y coordinates.
+  @param    n           Number of points.
+  @param    grid        Pointer to the new x coordinates, in increasing order.
+  @param    m           Number of new x coordinates.
+  @param    method      One of the GNUPLOT_RESAMPLE_ values.
+  @param    out         Output, m values at the new x coordinates.
+  @return   Number of values defined (not NaN).
+
+  The two lists are merged in a single pass. GNUPLOT_RESAMPLE_LINEAR
+  interpolates between the two surrounding points, and
+  GNUPLOT_RESAMPLE_NEAREST takes the closest of them; both give NaN
+  outside [x[0], x[n - 1]]. GNUPLOT_RESAMPLE_PREVIOUS takes the last
+  point at or before each new coordinate, NaN before x[0].
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API uint32_t gnuplot_resample(
+    const double* x,
+    const double* y,
+    uint32_t n,
+    const double* grid,
+    uint32_t m,
+    uint32_t method,
+    double* out);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Plot several lists of double resampled on common x coordinates.
+  @param    handle      Gnuplot session control handle.
+  @param    x           Pointer to lists of x coordinates, in increasing order.
+  @param    y           Pointer to lists of y coordinates.
+  @param    n           Pointer to numbers of double in x.
+  @param    l           Number of lists.
+  @param    grid        Common x coordinates, NULL to take those of x[0].
+  @param    m           Number of common x coordinates.
+  @param    method      One of the GNUPLOT_RESAMPLE_ values.
+  @param    title       Pointer to titles of the plot.
+  @return   void
+
+  Like gnuplot_plot_multi_xy(), but the series are resampled as by
+  gnuplot_resample() on one set of x coordinates while being sent.
+  The x coordinates are then sent once, in a single datablock with
+  one column per series, each series being plotted "using 1:k" from
+  it. Points where a series is not defined are left out of its line.
+
+  Example:
+
+  @code
+    // three sensors sampled at their own times, shown on the first's
+    gnuplot_plot_multi_xy_resampled(h, t, v, n, 3, NULL, 0,
+        GNUPLOT_RESAMPLE_PREVIOUS, titles);
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_plot_multi_xy_resampled(
+    gnuplot_ctrl* handle,
+    double** x,
+    double** y,
+    uint32_t* n,
+    uint32_t l,
+    const double* grid,
+    uint32_t m,
+    uint32_t method,
+    const char** title);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Plot the density of many series as an image.
+  @param    handle      Gnuplot session control handle.
+  @param    x           Pointer to lists of x coordinates.
+  @param    y           Pointer to lists of y coordinates.
+  @param    n           Pointer to numbers of double in x.
+  @param    l           Number of lists.
+  @param    width       Width of the image in pixels.
+  @param    height      Height of the image in pixels.
+  @param    cmap        Colormap, one of the GNUPLOT_CMAP_ values.
+  @param    flags       GNUPLOT_DENSITY_LOG for a logarithmic scale, or 0.
+  @param    title       Title of the plot.
+  @return   void
+
+  Takes the same series as gnuplot_plot_multi_xy(), but draws them in
+  the library instead of having gnuplot draw one polyline per series.
+  Every series is rasterized into a width x height grid of hit counts
+  (a pixel counts once per line segment crossing it), series being
+  spread over threads. The counts are then sent once, in binary, as an
+  image covering the extent of the data.
+
+  With GNUPLOT_CMAP_PALETTE the counts are sent scaled to [0, 1] and
+  drawn "with image" in the colors of the gnuplot palette. With the
+  other colormaps, colors are computed here and drawn "with rgbalpha".
+  Pixels no series crosses are left transparent in both cases.
+  Points that are NaN or infinite are skipped and cut their series.
+
+  This is the way to plot thousands of overlapping series, where drawing
+  each of them takes gnuplot far longer than the image does.
+
+  Example:
+
+  @code
+    // 10000 series of 1000 points each
+    gnuplot_plot_density(h, x, y, n, 10000, 1000, 600,
+        GNUPLOT_CMAP_VIRIDIS, GNUPLOT_DENSITY_LOG, "cpu");
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_plot_density(
+    gnuplot_ctrl* handle,
+    double** x,
+    double** y,
+    uint32_t* n,
+    uint32_t l,
+    uint32_t width,
+    uint32_t height,
+    uint32_t cmap,
+    uint32_t flags,
+    const char* title);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Plot contour lines of a grid.
+  @param    handle      Gnuplot session control handle.
+  @param    grid        Values, rows of cols doubles one after another.
+  @param    rows        Number of rows.
+  @param    cols        Number of columns.
+  @param    levels      Values to draw contour lines at.
+  @param    nlevels     Number of levels.
+  @param    title       Title of the plot.
+  @return   void
+
+  Extracts the contour lines in the library with marching squares, the
+  grid being split in bands of rows over threads, and sends only the
+  line segments, in binary. This replaces "set contour", which needs
+  the whole grid sent as text and is slow on large grids.
+
+  Column c of row r is drawn at (c, r). Segments are colored by level
+  with the gnuplot palette. Cells with a NaN corner are skipped.
+
+  Example:
+
+  @code
+    double levels[] = { -0.5, 0.0, 0.5 };
+
+    gnuplot_plot_contours(h, field, 8192, 8192, levels, 3, "field");
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_plot_contours(
+    gnuplot_ctrl* handle,
+    const double* grid,
+    uint32_t rows,
+    uint32_t cols,
+    const double* levels,
+    uint32_t nlevels,
+    const char* title);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Interpolate scattered points on a regular grid.
+  @param    x           Pointer to a list of x coordinates.
+  @param    y           Pointer to a list of y coordinates.
+  @param    z           Pointer to a list of values.
+  @param    n           Number of points.
+  @param    rows        Number of rows of the grid.
+  @param    cols        Number of columns of the grid.
+  @param    method      GNUPLOT_GRID_BIN or GNUPLOT_GRID_IDW.
+  @param    power       Power of the distance for GNUPLOT_GRID_IDW (2 if 0).
+  @param    grid        Output, rows * cols values, row after row.
+  @param    bounds      Output, xmin, xmax, ymin, ymax of the grid.
+  @return   0 on success, -1 on invalid input or out of memory.
+
+  Replaces "set dgrid3d", which is quadratic in the number of points.
+  The grid covers the extent of the points, node (r, c) being at
+  x = xmin + c * (xmax - xmin) / (cols - 1), and likewise for y.
+
+  Points are first sorted by nearest node, the node grid acting as a
+  spatial hash. GNUPLOT_GRID_BIN then gives each node the average of
+  its points, NaN if it has none. GNUPLOT_GRID_IDW weights points by
+  the inverse of their distance to the power given, searching rings
+  of nodes around each node until at least 8 points are found. Rows
+  of the grid are computed in parallel.
+  Points with a NaN or infinite coordinate are skipped.
+
+  The result is meant for gnuplot_splot_grid().
+
+  Example:
+
+  @code
+    double bounds[4];
+    double* grid = malloc(sizeof(double) * 200 * 200);
+
+    gnuplot_grid_scattered(x, y, z, n, 200, 200, GNUPLOT_GRID_IDW, 2.0,
+        grid, bounds);
+    // colored surface, gnuplot_setstyle() only takes line styles
+    gnuplot_cmd(h, "set pm3d at s");
+    gnuplot_setstyle(h, "lines");
+    gnuplot_splot_grid(h, grid, 200, 200, bounds, "surface");
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API int gnuplot_grid_scattered(
+    const double* x,
+    const double* y,
+    const double* z,
+    uint32_t n,
+    uint32_t rows,
+    uint32_t cols,
+    uint32_t method,
+    double power,
+    double* grid,
+    double* bounds);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Plot a regular grid as a surface.
+  @param    handle      Gnuplot session control handle.
+  @param    grid        Values, rows of cols doubles one after another.
+  @param    rows        Number of rows.
+  @param    cols        Number of columns.
+  @param    bounds      xmin, xmax, ymin, ymax of the grid.
+  @param    title       Title of the plot.
+  @return   void
+
+  The grid is sent in binary with "splot", in the current style.
+  NaN values are left undefined by gnuplot.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_splot_grid(
+    gnuplot_ctrl* handle,
+    const double* grid,
+    uint32_t rows,
+    uint32_t cols,
+    const double* bounds,
+    const char* title);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Plot the kernel density estimate of samples.
+  @param    handle      Gnuplot session control handle.
+  @param    samples     Pointer to a list of samples.
+  @param    n           Number of samples.
+  @param    bandwidth   Bandwidth of the Gaussian kernel, 0 for Silverman's rule.
+  @param    points      Number of points of the curve, 512 if 0.
+  @param    title       Title of the plot.
+  @return   void
+
+  Computes the density in the library instead of sending every sample
+  for "smooth kdensity": samples are binned linearly on the points of
+  the curve, and the bins convolved with a Gaussian through an FFT.
+  This costs O(n + points log points), and only the curve is sent, in
+  binary, in the current style.
+
+  The curve extends 3 bandwidths past the smallest and largest sample.
+  NaN and infinite samples are ignored.
+
+  Example:
+
+  @code
+    gnuplot_setstyle(h, "lines");
+    gnuplot_plot_kde(h, latencies, n, 0.0, 0, "latency");
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_plot_kde(
+    gnuplot_ctrl* handle,
+    const double* samples,
+    uint32_t n,
+    double bandwidth,
+    uint32_t points,
+    const char* title);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Plot the magnitude spectrum of samples.
+  @param    handle      Gnuplot session control handle.
+  @param    samples     Pointer to a list of samples.
+  @param    n           Number of samples.
+  @param    fs          Sampling frequency.
+  @param    window      Window, one of the GNUPLOT_WINDOW_ values.
+  @param    title       Title of the plot.
+  @return   void
+
+  The samples are windowed, zero-padded to a power of two and
+  transformed with a real FFT in the library. The one-sided magnitude
+  is plotted in dB against frequency, a full scale sine reading 0 dB.
+  Spectra of more than 2048 bins are reduced to 2048 points keeping
+  the peak of each group of bins, so that no tone disappears.
+
+  The FFT plan, the window and the buffers are kept in the handle, so
+  that calls with the same n and window allocate nothing.
+
+  Example:
+
+  @code
+    gnuplot_setstyle(h, "lines");
+    gnuplot_cmd(h, "set logscale x");
+    gnuplot_plot_spectrum(h, vibration, 1 << 20, 51200.0,
+        GNUPLOT_WINDOW_HANN, "sensor 1");
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_plot_spectrum(
+    gnuplot_ctrl* handle,
+    const double* samples,
+    uint32_t n,
+    double fs,
+    uint32_t window,
+    const char* title);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Aggregates ticks into OHLC bars.
+  @param    t           Pointer to a list of tick times, in increasing order.
+  @param    price       Pointer to a list of tick prices.
+  @param    volume      Pointer to a list of tick volumes, may be NULL.
+  @param    n           Number of ticks.
+  @param    interval    Duration of a bar, in the unit of t.
+  @param    bars        Output bars.
+  @param    max         Size of bars.
+  @return   Number of bars written.
+
+  Bar k covers [origin + k * interval, origin + (k + 1) * interval),
+  origin being t[0] rounded down to a multiple of interval. Intervals
+  without ticks give no bar, so bars are not necessarily evenly spaced.
+  Ticks with a NaN or infinite time or price are ignored. Ticks after the first
+  max bars are ignored too.
+
+  Ticks are aggregated in one pass, in chunks over threads; bars cut by
+  a chunk boundary are merged afterwards.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API uint32_t gnuplot_ohlc_aggregate(
+    const double* t,
+    const double* price,
+    const double* volume,
+    uint64_t n,
+    double interval,
+    gnuplot_ohlc* bars,
+    uint32_t max);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Plots OHLC bars as candlesticks, with volume.
+  @param    handle      Gnuplot session control handle.
+  @param    bars        Pointer to a list of bars.
+  @param    n           Number of bars.
+  @param    interval    Interval of the bars, 0 for the closest two bars.
+  @param    title       Title of the plot.
+  @return   void
+
+  Bars are sent in binary and drawn "with candlesticks", centred on
+  their interval, 80% of it wide. The volume is drawn with boxes on the
+  y2 axis, which needs "set y2tics" to show a scale.
+
+  Without an interval it is taken as the smallest gap between two bars,
+  so a single bar needs one to get a width on the scale of its time
+  axis; it is 1 otherwise. Bars with a NaN or infinite time are not
+  drawn.
+
+  Example:
+
+  @code
+    gnuplot_ohlc* bars = malloc(sizeof(gnuplot_ohlc) * 1440);
+    uint32_t n = gnuplot_ohlc_aggregate(t, price, volume, ticks, 60.0,
+        bars, 1440);
+
+    gnuplot_cmd(h, "set y2tics");
+    gnuplot_plot_ohlc(h, bars, n, 60.0, "EURUSD");
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_plot_ohlc(
+    gnuplot_ctrl* handle,
+    const gnuplot_ohlc* bars,
+    uint32_t n,
+    double interval,
+    const char* title);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Plot a binary file too large to be held in memory.
+  @param    handle  Gnuplot session control handle.
+  @param    path    File of float64 records, in native byte order.
+  @param    layout  GNUPLOT_FILE_Y or GNUPLOT_FILE_XY.
+  @param    reducer GNUPLOT_REDUCE_MINMAX or GNUPLOT_REDUCE_LTTB.
+  @param    target  Most points sent to gnuplot.
+  @param    flags   0 or GNUPLOT_FILE_MMAP.
+  @param    title   Title of the plot.
+  @return   0 on success, -1 if the file cannot be read.
+
+  The file is cut in buckets of consecutive records, which threads
+  reduce in parallel, each reading its part in windows of 4 MB. Only
+  the reduced points are sent to gnuplot, as binary data:
+
+  - GNUPLOT_REDUCE_MINMAX sends the smallest and largest y of target / 2
+    buckets, in file order, so that no peak is lost.
+  - GNUPLOT_REDUCE_LTTB sends the first and last records and, from each
+    of target - 2 buckets, the one making the largest triangle with the
+    point picked before and the average of the next bucket. It reads
+    the file twice, first for the averages.
+
+  Windows are read with pread(), the kernel reading the next one ahead,
+  or with GNUPLOT_FILE_MMAP from a mapping of the whole file advised as
+  sequential. Either way the pages of a window are dropped once it is
+  reduced, so memory stays at a window per thread plus the buckets,
+  whatever the size of the file. NaN records are skipped, and a file
+  of at most target records is sent whole.
+
+  Example:
+
+  @code
+    gnuplot_setstyle(h, "lines");
+    gnuplot_plot_file(h, "trace.f64", GNUPLOT_FILE_Y, GNUPLOT_REDUCE_MINMAX, 4000, 0, "trace");
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API int gnuplot_plot_file(
+    gnuplot_ctrl* handle,
+    const char* path,
+    uint32_t layout,
+    uint32_t reducer,
+    uint32_t target,
+    uint32_t flags,
+    const char* title);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Plot a slope on a gnuplot session.
+  @param    handle      Gnuplot session control handle.
+  @param    a           Slope.
+  @param    b           Intercept.
+  @param    title       Title of the plot.
+  @return   void
 
   Plot a slope on a gnuplot session. The provided slope has an
   equation of the form y=ax+b
@@ -493,7 +1646,7 @@ void gnuplot_plot_multi_xy(
   @endcode
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_plot_slope(
+GNUPLOT_API void gnuplot_plot_slope(
     gnuplot_ctrl* handle,
     double a,
     double b,
@@ -523,11 +1676,627 @@ void gnuplot_plot_slope(
   @endcode
  */
 /*--------------------------------------------------------------------------*/
-void gnuplot_plot_equation(
+GNUPLOT_API void gnuplot_plot_equation(
     gnuplot_ctrl* handle,
     const char* equation,
     const char* title);
 
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Sample equations according to the width of the plot.
+  @param    handle      Gnuplot session control handle.
+  @param    oversample  Samples per pixel, 0 to leave samples to gnuplot.
+  @return   void
+
+  Before plotting, gnuplot_plot_equation() sets gnuplot's samples to
+  the width of the plot in pixels times oversample, so that curves are
+  smooth without evaluating the equation more often than can be seen.
+  The width is asked to gnuplot once, from the GPVAL_TERM_ variables
+  of the last plot, 640 being used before a first plot. "set samples"
+  is only sent when the count changes.
+
+  The width is cached until a command sent with gnuplot_cmd() may
+  change the terminal or the plot size ("set terminal", "set size",
+  "reset", or a "load", which templates use), and samples are set again
+  after "set samples", "unset samples" or "reset"; commands are checked
+  once formatted. Lines sent with gnuplot_printf(), data lines mostly,
+  are not checked. Resizing the window of an interactive
+  terminal is not seen: call gnuplot_set_samples_auto() again to have
+  the width asked anew.
+
+  Example:
+
+  @code
+    gnuplot_set_samples_auto(h, 1.5);
+    gnuplot_plot_equation(h, "besj0(x) * exp(-x / 10)", "damped");
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_set_samples_auto(gnuplot_ctrl* handle, double oversample);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Starts a pool of gnuplot sessions.
+  @param    size    Number of sessions to keep warm.
+  @return   Newly allocated pool, NULL on error.
+
+  Starts size gnuplot processes right away. They initialize in the
+  background while the program does something else.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API gnuplot_pool* gnuplot_pool_init(uint32_t size);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Takes a session from a pool.
+  @param    pool    Pool of sessions.
+  @return   Gnuplot session control handle, NULL on error.
+
+  Hands out a warm session. If the pool is empty, a new session is
+  started.
+
+  The session must be given back with gnuplot_pool_release(), not closed
+  with gnuplot_close().
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API gnuplot_ctrl* gnuplot_pool_acquire(gnuplot_pool* pool);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Gives a session back to a pool.
+  @param    pool    Pool of sessions.
+  @param    handle  Session from gnuplot_pool_acquire().
+  @return   void
+
+  The session is reset ("reset session", default terminal, no output
+  file) and kept for the next gnuplot_pool_acquire(), or closed if the
+  pool is already full. Never release a session in the middle of a plot.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_pool_release(gnuplot_pool* pool, gnuplot_ctrl* handle);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Closes a pool and all its idle sessions.
+  @param    pool    Pool of sessions.
+  @return   void
+
+  Sessions still acquired are not affected, close them with
+  gnuplot_close().
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_pool_close(gnuplot_pool* pool);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Serves the sessions of a pool to other processes.
+  @param    pool    Pool of sessions.
+  @param    path    Path of the Unix socket to listen on.
+  @return   -1 on error, does not return otherwise.
+
+  This is the main loop of gnuplotd. Clients connect with
+  gnuplot_connect(), or with gnuplot_init() and GNUPLOTD_SOCKET set in
+  their environment. Each client gets one session of the pool; the
+  session goes back to the pool when the client closes it, and is
+  killed if the client disconnects without closing it.
+
+  The socket is only accessible to the user running the daemon.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API int gnuplot_pool_serve(gnuplot_pool* pool, const char* path);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Creates an empty session template.
+  @return   The template, NULL if out of memory.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API gnuplot_template* gnuplot_template_init(void);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Adds a command to a template.
+  @param    tpl     Template.
+  @param    cmd     Command to add, printf-like format.
+  @param    ...     Arguments of the format.
+  @return   0 on success, -1 once the template has been applied.
+
+  A template is fixed by its first gnuplot_template_apply(), since
+  sessions may still have to load it: commands can only be added
+  before.
+
+  Example:
+
+  @code
+    gnuplot_template* tpl = gnuplot_template_init();
+    gnuplot_template_cmd(tpl, "set grid");
+    gnuplot_template_cmd(tpl, "set xlabel \"%s\"", "time (s)");
+    gnuplot_template_cmd(tpl, "set style line 1 lc rgb '#0060ad' lw 2");
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API int gnuplot_template_cmd(gnuplot_template* tpl, const char* cmd, ...);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Runs the commands of a template in a session.
+  @param    handle  Gnuplot session control handle.
+  @param    tpl     Template.
+  @return   0 on success, -1 if the template file cannot be written.
+
+  Sends a single "load" command. The handle remembers the template and
+  applies it again when gnuplot_monitor() respawns gnuplot, so the
+  template must stay open as long as the handle.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API int gnuplot_template_apply(gnuplot_ctrl* handle, gnuplot_template* tpl);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Closes a template and removes its file.
+  @param    tpl     Template.
+  @return   void
+
+  Sessions that have not yet run the "load" of the template fail to
+  load it, so sessions using it should be closed or synced with
+  gnuplot_sync() first.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_template_close(gnuplot_template* tpl);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Applies a template to every session of a pool.
+  @param    pool    Pool of gnuplot sessions.
+  @param    tpl     Template, NULL for none.
+  @return   void
+
+  Idle sessions get the template at once, so that they are handed out
+  by gnuplot_pool_acquire() ready to plot. Sessions started later by
+  the pool, and sessions given back with gnuplot_pool_release(), get it
+  again after being reset. The template must stay open as long as the
+  pool.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_pool_set_template(gnuplot_pool* pool, gnuplot_template* tpl);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Saves the state of a session.
+  @param    handle  Gnuplot session control handle.
+  @return   The saved state, NULL on error.
+
+  gnuplot writes its settings, functions, variables and last plot
+  command with "save", and prints back the datablocks sent by the
+  plot functions since the last gnuplot_resetplot(). Both go to one
+  file, in /dev/shm when it exists, that gnuplot_clone() loads. This
+  waits for gnuplot with gnuplot_sync().
+
+  Plots of inline data are left out of the saved plot command, since
+  gnuplot keeps no copy of that data, and the command is commented out
+  if nothing else remains: turn on gnuplot_set_datablock() in sessions
+  meant to be cloned. A clone then starts from the plots that remain,
+  or from a new "plot" if none do.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API gnuplot_session* gnuplot_snapshot(gnuplot_ctrl* handle);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Opens a session in the state of a snapshot.
+  @param    session Snapshot taken by gnuplot_snapshot().
+  @param    pool    Pool to take the session from, NULL to start one.
+  @return   The new handle, NULL on error.
+
+  The new session runs a single "load" of the snapshot file, which
+  defines the datablocks again, restores the settings and draws the
+  saved plot. The handle has the plotting style of the original one,
+  and further plots are added to the restored ones.
+
+  Example:
+
+  @code
+    gnuplot_session* s = gnuplot_snapshot(h);
+    gnuplot_ctrl* copy = gnuplot_clone(s, NULL);
+    gnuplot_sync(copy, 1000);
+    gnuplot_session_close(s);
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API gnuplot_ctrl* gnuplot_clone(const gnuplot_session* session, gnuplot_pool* pool);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Closes a snapshot and removes its file.
+  @param    session Snapshot taken by gnuplot_snapshot().
+  @return   void
+
+  Clones that have not yet run the "load" fail to restore the state,
+  so they should be synced with gnuplot_sync() first.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_session_close(gnuplot_session* session);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Creates an event loop.
+  @param    quantum     Bytes written per batch handle per turn, 0 for 64K.
+  @return   Newly allocated loop, NULL on error.
+
+  Example:
+
+  @code
+    gnuplot_loop* loop = gnuplot_loop_init(0);
+
+    gnuplot_loop_add(loop, dashboard, GNUPLOT_PRIO_INTERACTIVE);
+    gnuplot_loop_add(loop, export, GNUPLOT_PRIO_BATCH);
+    for (;;) {
+        if (gnuplot_loop_pending(export) < (1 << 20))
+            plot_next_chunk(export);
+        if (dashboard_changed())
+            redraw(dashboard);
+        gnuplot_loop_run(loop, 10);
+    }
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API gnuplot_loop* gnuplot_loop_init(size_t quantum);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Adds a handle to an event loop.
+  @param    loop    Event loop.
+  @param    handle  Gnuplot session control handle.
+  @param    prio    GNUPLOT_PRIO_INTERACTIVE or GNUPLOT_PRIO_BATCH.
+  @return   0 on success, -1 on error.
+
+  From then on, everything sent to the handle is queued until written
+  by gnuplot_loop_run(). gnuplot_sync() still works, it writes the
+  queue of its handle first. Needs glibc.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API int gnuplot_loop_add(gnuplot_loop* loop, gnuplot_ctrl* handle, uint32_t prio);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Removes a handle from an event loop.
+  @param    loop    Event loop.
+  @param    handle  Gnuplot session control handle.
+  @return   void
+
+  The queue of the handle is written first, blocking as needed. Closing
+  a handle removes it from its loop.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_loop_remove(gnuplot_loop* loop, gnuplot_ctrl* handle);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Writes queued commands to gnuplot.
+  @param    loop        Event loop.
+  @param    timeout_ms  Most time to wait for pipes, 0 not to wait, -1 forever.
+  @return   0 once nothing is queued, 1 on timeout, -1 if a pipe broke.
+
+  Turns go on until every queue is empty or the timeout expires. The
+  queue of a handle whose pipe broke is dropped.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API int gnuplot_loop_run(gnuplot_loop* loop, int timeout_ms);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Gets the number of bytes queued for a handle.
+  @param    handle  Gnuplot session control handle.
+  @return   Bytes waiting for gnuplot_loop_run().
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API size_t gnuplot_loop_pending(const gnuplot_ctrl* handle);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Frees an event loop.
+  @param    loop    Event loop.
+  @return   void
+
+  Every handle is removed from the loop first.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_loop_close(gnuplot_loop* loop);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Renders a sequence of frames on several gnuplot sessions.
+  @param    pool        Pool to take the sessions from, NULL for a new one.
+  @param    nworkers    Number of sessions, 0 for one per CPU.
+  @param    nframes     Number of frames.
+  @param    terminal    Terminal of the frames, e.g. "pngcairo size 1280,720".
+  @param    pattern     File name of frame i, printf pattern taking i, or NULL.
+  @param    gen         Plots frame i on the session given.
+  @param    sink        Receives the bytes of frame i, or NULL.
+  @param    user        Passed to gen and sink.
+  @return   0 on success, -1 if a frame or the sink failed.
+
+  Frames are spread over nworkers gnuplot sessions taken from the pool,
+  each fed by its own thread, so that gnuplot renders nworkers frames at
+  once. For every frame, gen() is called on the thread of a session,
+  with the output already set, and plots the frame on it. gen() is
+  called from several threads at once and must be thread-safe.
+
+  Exactly one of pattern and sink must be given. With a pattern, gnuplot
+  writes frame i to the file it names. With a sink, frames are rendered
+  to temporary files in /dev/shm, read back, and handed to sink() in
+  order 0, 1, 2... on the calling thread, whatever order they finish in.
+  At most 2 * nworkers frames wait for delivery at any time. A sink
+  returning non-zero stops the export.
+
+  Example:
+
+  @code
+    static void frame(gnuplot_ctrl* h, uint32_t i, void* user)
+    {
+        char eq[64];
+
+        snprintf(eq, sizeof(eq), "sin(x + %f)", i * 0.1);
+        gnuplot_plot_equation(h, eq, "phase");
+    }
+
+    gnuplot_export_frames(NULL, 0, 600, "pngcairo size 1280,720",
+        "frames/%05u.png", frame, NULL, NULL);
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API int gnuplot_export_frames(
+    gnuplot_pool* pool,
+    uint32_t nworkers,
+    uint32_t nframes,
+    const char* terminal,
+    const char* pattern,
+    gnuplot_frame_fn gen,
+    gnuplot_sink_fn sink,
+    void* user);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Creates a shared ring of samples.
+  @param    capacity    Number of samples, rounded up to a power of two.
+  @return   Newly allocated ring, NULL on error.
+
+  The ring is backed by an anonymous memfd, see gnuplot_ring_fd() to
+  share it with another process.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API gnuplot_ring* gnuplot_ring_create(uint32_t capacity);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Maps a ring created by another process.
+  @param    fd      File descriptor of the ring.
+  @return   Newly allocated ring, NULL on error.
+
+  The file descriptor is duplicated, the caller keeps ownership of fd.
+
+  Example:
+
+  @code
+    gnuplot_ring* r = gnuplot_ring_create(1 << 16);
+
+    if (fork() == 0) {
+        // producer
+        gnuplot_ring* p = gnuplot_ring_attach(gnuplot_ring_fd(r));
+        for (;;) {
+            double v = read_sensor();
+            gnuplot_ring_push(p, NULL, &v, 1);
+        }
+    }
+
+    // display
+    gnuplot_ctrl* h = gnuplot_init();
+    for (;;) {
+        gnuplot_ring_wait(r, 100);
+        gnuplot_resetplot(h);
+        gnuplot_plot_ring(h, r, 1000, "sensor");
+    }
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API gnuplot_ring* gnuplot_ring_attach(int fd);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Gets the file descriptor of a ring.
+  @param    ring    Shared ring.
+  @return   File descriptor, owned by the ring.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API int gnuplot_ring_fd(const gnuplot_ring* ring);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Appends samples to a ring (producer side).
+  @param    ring    Shared ring.
+  @param    x       Pointer to x coordinates, NULL to use the sample number.
+  @param    y       Pointer to y coordinates.
+  @param    n       Number of samples.
+  @return   Number of samples appended.
+
+  The producer never blocks: samples that do not fit because the
+  consumer is behind are dropped and counted, see gnuplot_ring_dropped().
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API uint32_t gnuplot_ring_push(
+    gnuplot_ring* ring,
+    const double* x,
+    const double* y,
+    uint32_t n);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Takes the oldest samples out of a ring (consumer side).
+  @param    ring    Shared ring.
+  @param    x       Buffer for x coordinates, may be NULL.
+  @param    y       Buffer for y coordinates, may be NULL.
+  @param    max     Size of the buffers.
+  @return   Number of samples taken.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API uint32_t gnuplot_ring_read(
+    gnuplot_ring* ring,
+    double* x,
+    double* y,
+    uint32_t max);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Waits for new samples in a ring (consumer side).
+  @param    ring        Shared ring.
+  @param    timeout_ms  Timeout in ms, -1 to wait forever.
+  @return   1 if samples were appended since the last plot or read, else 0.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API int gnuplot_ring_wait(gnuplot_ring* ring, int timeout_ms);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Gets the number of samples dropped by the producer.
+  @param    ring    Shared ring.
+  @return   Number of samples dropped because the ring was full.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API uint64_t gnuplot_ring_dropped(const gnuplot_ring* ring);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Unmaps a ring.
+  @param    ring    Shared ring.
+  @return   void
+
+  The memory is freed once both processes have closed the ring.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_ring_close(gnuplot_ring* ring);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Plots the latest samples of a ring (consumer side).
+  @param    handle  Gnuplot session control handle.
+  @param    ring    Shared ring.
+  @param    window  Number of samples to show, 0 for the whole ring.
+  @param    title   Title of the plot.
+  @return   void
+
+  Plots the last window samples as a 2d graph, formatting them straight
+  from the shared memory. Older samples are given back to the producer,
+  the last window samples are kept so that the next frame can show them
+  again with the new ones, but never more than half the capacity of
+  the ring: the producer always has that much room. A window larger
+  than half the ring, or the whole ring, is only shown in full when the
+  producer has pushed enough new samples since the previous frame.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_plot_ring(
+    gnuplot_ctrl* handle,
+    gnuplot_ring* ring,
+    uint32_t window,
+    const char* title);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Starts a waterfall display (spectrogram).
+  @param    fft_size    Number of samples of each spectrum.
+  @param    hop         Number of samples between two spectra.
+  @param    rows        Number of spectra displayed.
+  @param    fs          Sampling frequency.
+  @param    window      Window, one of the GNUPLOT_WINDOW_ values.
+  @param    max_fps     Most frames drawn per second, 0 for no limit.
+  @return   Newly allocated waterfall, NULL on error.
+
+  Samples fed to the waterfall are cut in blocks of fft_size samples,
+  hop samples apart, so that blocks overlap when hop < fft_size. Each
+  block is transformed as in gnuplot_plot_spectrum() into one row of
+  dB magnitudes, written over the oldest row of a circular image.
+  Only the new rows are computed as samples come in.
+
+  Example:
+
+  @code
+    gnuplot_waterfall* wf = gnuplot_waterfall_init(1024, 256, 400,
+        48000.0, GNUPLOT_WINDOW_HANN, 25.0);
+
+    for (;;) {
+        gnuplot_ring_wait(r, 100);
+        if (gnuplot_waterfall_feed_ring(wf, r) > 0) {
+            gnuplot_resetplot(h);
+            gnuplot_waterfall_draw(h, wf, "microphone");
+        }
+    }
+  @endcode
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API gnuplot_waterfall* gnuplot_waterfall_init(
+    uint32_t fft_size,
+    uint32_t hop,
+    uint32_t rows,
+    double fs,
+    uint32_t window,
+    double max_fps);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Appends samples to a waterfall.
+  @param    wf      Waterfall.
+  @param    samples Pointer to a list of samples.
+  @param    n       Number of samples.
+  @return   Number of rows computed.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API uint32_t gnuplot_waterfall_feed(
+    gnuplot_waterfall* wf,
+    const double* samples,
+    uint32_t n);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Appends the new samples of a ring to a waterfall.
+  @param    wf      Waterfall.
+  @param    ring    Shared ring, whose y values are the samples.
+  @return   Number of rows computed.
+
+  Takes every sample out of the ring, see gnuplot_ring_read(). Samples
+  are copied straight into the block being filled.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API uint32_t gnuplot_waterfall_feed_ring(
+    gnuplot_waterfall* wf,
+    gnuplot_ring* ring);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Plots a waterfall.
+  @param    handle  Gnuplot session control handle.
+  @param    wf      Waterfall.
+  @param    title   Title of the plot.
+  @return   1 if a frame was sent, 0 if skipped.
+
+  The image is sent in binary "with image", frequency on x and time on
+  y, the newest row on top. Nothing is sent if no row was computed
+  since the last frame, or if the last frame is more recent than the
+  frame rate limit allows.
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API int gnuplot_waterfall_draw(
+    gnuplot_ctrl* handle,
+    gnuplot_waterfall* wf,
+    const char* title);
+
+/*--------------------------------------------------------------------------*/
+/**
+  @brief    Frees a waterfall.
+  @param    wf      Waterfall.
+  @return   void
+ */
+/*--------------------------------------------------------------------------*/
+GNUPLOT_API void gnuplot_waterfall_close(gnuplot_waterfall* wf);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,69 @@
+/*-------------------------------------------------------------------------*/
+/**
+  @file     gnuplotd.c
+  @brief    Daemon sharing warm gnuplot sessions between processes.
+
+  gnuplotd keeps a pool of gnuplot processes and hands them out to local
+  clients over a Unix socket, so that short-lived programs do not each
+  pay for starting gnuplot.
+
+  usage: gnuplotd [-s socket] [-n sessions]
+
+  The socket defaults to $GNUPLOTD_SOCKET, or gnuplotd.sock in
+  $XDG_RUNTIME_DIR, or /tmp/gnuplotd-<uid>.sock. Clients use it with
+  gnuplot_connect(), or with gnuplot_init() and GNUPLOTD_SOCKET set.
+
+*/
+/*--------------------------------------------------------------------------*/
+
+#include "gnuplot_i.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int main(int argc, char* argv[])
+{
+    char path[108];
+    const char* sock = getenv("GNUPLOTD_SOCKET");
+    const char* dir = getenv("XDG_RUNTIME_DIR");
+    uint32_t size = 4;
+    int opt;
+
+    if (sock != NULL && *sock != '\0')
+        snprintf(path, sizeof(path), "%s", sock);
+    else if (dir != NULL && *dir != '\0')
+        snprintf(path, sizeof(path), "%s/gnuplotd.sock", dir);
+    else
+        snprintf(path, sizeof(path), "/tmp/gnuplotd-%u.sock", (unsigned)getuid());
+    // the sessions of the pool are our own, they must not come from ourselves
+    unsetenv("GNUPLOTD_SOCKET");
+
+    while ((opt = getopt(argc, argv, "s:n:")) != -1) {
+        switch (opt) {
+        case 's':
+            snprintf(path, sizeof(path), "%s", optarg);
+            break;
+        case 'n':
+            size = (uint32_t)atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s socket] [-n sessions]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // a dying gnuplot must not take the daemon with it
+    signal(SIGPIPE, SIG_IGN);
+
+    gnuplot_pool* pool = gnuplot_pool_init(size);
+    if (pool == NULL)
+        return 1;
+
+    gnuplot_pool_serve(pool, path);
+    gnuplot_pool_close(pool);
+    return 1;
+}
+
+/* vim: set ts=4 et sw=4 tw=80 */
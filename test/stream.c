@@ -0,0 +1,59 @@
+
+/*
+ * Plotting samples produced by another process through a shared ring
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "gnuplot_i.h"
+
+#define NSAMPLES    20000
+#define WINDOW      500
+
+int main(int argc, char *argv[])
+{
+    gnuplot_ring    *   ring ;
+    gnuplot_ctrl    *   h ;
+    pid_t               pid ;
+
+    ring = gnuplot_ring_create(4096) ;
+    if (ring == NULL) {
+        fprintf(stderr, "cannot create the ring\n") ;
+        return 1 ;
+    }
+
+    pid = fork() ;
+    if (pid == 0) {
+        /* producer: a sensor sampled at 10 kHz */
+        gnuplot_ring * p = gnuplot_ring_attach(gnuplot_ring_fd(ring)) ;
+        for (int i = 0 ; i < NSAMPLES ; i++) {
+            double v = sin(i * 0.01) + 0.1 * sin(i * 0.37) ;
+            while (gnuplot_ring_push(p, NULL, &v, 1) == 0) {
+                usleep(100) ;
+            }
+            usleep(100) ;
+        }
+        gnuplot_ring_close(p) ;
+        _exit(0) ;
+    }
+
+    /* display: redraw whenever new samples are there */
+    h = gnuplot_init() ;
+    gnuplot_setstyle(h, "lines") ;
+    while (waitpid(pid, NULL, WNOHANG) == 0) {
+        if (gnuplot_ring_wait(ring, 100)) {
+            gnuplot_resetplot(h) ;
+            gnuplot_plot_ring(h, ring, WINDOW, "sensor") ;
+            usleep(40000) ;
+        }
+    }
+    printf("dropped samples: %llu\n", (unsigned long long)gnuplot_ring_dropped(ring)) ;
+
+    gnuplot_close(h) ;
+    gnuplot_ring_close(ring) ;
+    return 0 ;
+}